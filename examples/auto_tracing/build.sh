@@ -1,2 +1,3 @@
 clang -shared -fpic -O3 instrument.c -o instrument.so
 clang -ldl -lpthread -finstrument-functions -rdynamic -O3 sample_program.c ./instrument.so -o instrument_test
+clang++ -shared -fpic -fno-semantic-interposition -O3 -I../.. libspall_auto.cpp -o libspall_auto.so -ldl -lpthread
@@ -0,0 +1,138 @@
+/*
+	libspall_auto.so: spall_auto.h, set up from the environment, for tracing
+	-finstrument-functions builds without touching their code:
+
+		SPALL_OUT=server.spall LD_PRELOAD=./libspall_auto.so ./server
+
+	SPALL_OUT                trace file, spall_<pid>.spall by default
+	SPALL_BUFFER_SIZE        bytes per thread, with an optional K/M/G, 64M by default
+	SPALL_SYMBOL_CACHE_SIZE  names cached per thread, 100000 by default
+	SPALL_FILTER             comma separated bits of function names, only functions with one of them get traced
+	SPALL_ENABLE             0 starts with tracing off (same as spall_auto.h)
+
+	Every thread made with pthread_create gets registered on its way in and flushed on its way out,
+	and the main thread gets flushed (and the file closed) by a destructor. Threads still running
+	at exit lose whatever's left in their buffers.
+*/
+
+#include <x86intrin.h>
+#define SPALL_AUTO_IMPLEMENTATION
+#include "spall_auto.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+
+static size_t preload_buffer_size = SPALL_DEFAULT_BUFFER_SIZE;
+static int64_t preload_symbol_cache_size = SPALL_DEFAULT_SYMBOL_CACHE_SIZE;
+static char *preload_filter;
+static pthread_key_t preload_thread_key;
+
+typedef struct {
+	void *(*start)(void *);
+	void *arg;
+} PreloadThreadStart;
+
+SPALL_NOINSTRUMENT static uint32_t preload_tid(void) {
+	return (uint32_t)syscall(SYS_gettid);
+}
+
+SPALL_NOINSTRUMENT static size_t preload_parse_size(const char *str, size_t fallback) {
+	if (!str || !*str) {
+		return fallback;
+	}
+
+	char *end;
+	unsigned long long size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'k': case 'K': size <<= 10; break;
+	case 'm': case 'M': size <<= 20; break;
+	case 'g': case 'G': size <<= 30; break;
+	}
+	return size ? (size_t)size : fallback;
+}
+
+SPALL_NOINSTRUMENT static bool preload_filter_name(const char *name, int name_len) {
+	for (const char *part = preload_filter; *part; ) {
+		const char *part_end = strchr(part, ',');
+		int part_len = part_end ? (int)(part_end - part) : (int)strlen(part);
+
+		for (int i = 0; part_len > 0 && i + part_len <= name_len; i++) {
+			if (memcmp(name + i, part, part_len) == 0) {
+				return true;
+			}
+		}
+
+		if (!part_end) {
+			break;
+		}
+		part = part_end + 1;
+	}
+	return false;
+}
+
+// runs on the way out of every thread we registered, however it leaves
+SPALL_NOINSTRUMENT static void preload_thread_exit(void *unused) {
+	(void)unused;
+	spall_auto_thread_quit();
+}
+
+SPALL_NOINSTRUMENT static void *preload_thread_start(void *ptr) {
+	PreloadThreadStart start = *(PreloadThreadStart *)ptr;
+	free(ptr);
+
+	spall_auto_thread_init(preload_tid(), preload_buffer_size, preload_symbol_cache_size);
+	pthread_setspecific(preload_thread_key, (void *)1);
+
+	return start.start(start.arg);
+}
+
+extern "C" SPALL_NOINSTRUMENT int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start)(void *), void *arg) {
+	static int (*real_create)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+	if (!real_create) {
+		real_create = (int (*)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *))dlsym(RTLD_NEXT, "pthread_create");
+	}
+
+	PreloadThreadStart *wrapped = (PreloadThreadStart *)malloc(sizeof(PreloadThreadStart));
+	if (!wrapped) {
+		return real_create(thread, attr, start, arg);
+	}
+	wrapped->start = start;
+	wrapped->arg = arg;
+
+	int ret = real_create(thread, attr, preload_thread_start, wrapped);
+	if (ret != 0) {
+		free(wrapped);
+	}
+	return ret;
+}
+
+__attribute__((constructor)) SPALL_NOINSTRUMENT static void preload_init(void) {
+	preload_buffer_size = preload_parse_size(getenv("SPALL_BUFFER_SIZE"), SPALL_DEFAULT_BUFFER_SIZE);
+	preload_symbol_cache_size = (int64_t)preload_parse_size(getenv("SPALL_SYMBOL_CACHE_SIZE"), SPALL_DEFAULT_SYMBOL_CACHE_SIZE);
+
+	preload_filter = getenv("SPALL_FILTER");
+	if (preload_filter && *preload_filter) {
+		spall_auto_set_filter(preload_filter_name);
+	}
+
+	char default_out[64];
+	char *out = getenv("SPALL_OUT");
+	if (!out || !*out) {
+		snprintf(default_out, sizeof(default_out), "spall_%d.spall", (int)getpid());
+		out = default_out;
+	}
+
+	pthread_key_create(&preload_thread_key, preload_thread_exit);
+	spall_auto_init(out);
+	spall_auto_thread_init(preload_tid(), preload_buffer_size, preload_symbol_cache_size);
+}
+
+__attribute__((destructor)) SPALL_NOINSTRUMENT static void preload_quit(void) {
+	spall_auto_thread_quit();
+	spall_auto_quit();
+}
@@ -4,12 +4,41 @@
 // THIS IS EXPERIMENTAL, BUT VERY HANDY
 // *should* work on clang/msvc on Windows, Mac, and Linux
 
+// Tracing can be turned off at runtime, so the hooks just check a flag and bail
+// (functions already inside a traced call when it goes off still get their End):
+//   - SPALL_ENABLE=0 in the environment starts with it off
+//   - spall_auto_set_enabled() flips it from code
+//   - #define SPALL_AUTO_TOGGLE_SIGNAL SIGUSR2 flips it on every kill -USR2 <pid>
+
+// Linux x86-64 only: #define SPALL_AUTO_PATCHABLE and build with -fpatchable-function-entry=7,5
+// instead of -finstrument-functions. Functions start out as NOPs and cost nothing until
+// spall_auto_patch() points them at our trampolines (optionally filtered by raw symbol name,
+// which comes from the symbol table, so build with -no-pie for the filter to see them),
+// and spall_auto_unpatch() puts the NOPs back, while the program is running.
+// Patched functions get their return address swapped out to catch the exit,
+// so don't unwind (C++ exceptions, longjmp) through them.
+
+// Linux only: #define SPALL_AUTO_MALLOC to also take over malloc/calloc/realloc/free (and the aligned ones),
+// and write every allocation and free on a traced thread into its buffer, for the viewer's live bytes track.
+// They pass straight through to glibc's allocator, and anything we allocate ourselves goes by untraced.
+// Link (or LD_PRELOAD) whatever you build this into, don't dlopen it.
+
+// Linux only: #define SPALL_AUTO_LOCKS to wrap pthread_mutex_lock, pthread_rwlock_rdlock/wrlock and pthread_cond_wait/timedwait.
+// Locks try the fast path first, and only get a "mutex wait" zone when it fails, so uncontended ones cost a trylock.
+// The zone's args are {"lock":"<lock>"}, <lock> being the lock's symbol if it's a global, or its address,
+// which the viewer's stats pane uses to break the waits out per lock.
+
+// Linux only: #define SPALL_AUTO_IO to wrap the usual blocking calls (read/write and friends, send/recv, fsync, poll, sleeps).
+// Calls that take longer than SPALL_IO_THRESHOLD_US in the environment (or SPALL_AUTO_IO_THRESHOLD_US, 10 us by default)
+// get a zone named after the call, with {"fd":N,"bytes":N} (bytes being what it returned) as its args.
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define _GNU_SOURCE
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef struct {
@@ -40,8 +69,19 @@ typedef struct {
 
 void spall_auto_init(char *filename);
 void spall_auto_quit(void);
+void spall_auto_set_enabled(bool enabled);
 void spall_auto_thread_init(uint32_t _tid, size_t buffer_size, int64_t symbol_cache_size);
 void spall_auto_thread_quit(void);
+typedef bool (*SpallAutoFilter)(const char *name, int name_len);
+#if !_WIN32 && !defined(SPALL_AUTO_PATCHABLE)
+// Only functions the filter says yes to get traced. Set it before spall_auto_init, names get cached with the answer.
+// (Patchable builds hand their filter to spall_auto_patch instead.)
+void spall_auto_set_filter(SpallAutoFilter filter);
+#endif
+#ifdef SPALL_AUTO_PATCHABLE
+int spall_auto_patch(SpallAutoFilter filter);
+int spall_auto_unpatch(void);
+#endif
 #if _MSC_VER && !__clang__
 #ifndef _PROCESSTHREADSAPI_H_
 extern __declspec(dllimport) int(__stdcall TlsSetValue)(unsigned long dwTlsIndex, void* lpTlsValue);
@@ -79,10 +119,38 @@ extern "C" {
 
 static SpallProfile spall_ctx;
 static AddrHash global_addr_map;
-static _Thread_local SpallBuffer spall_buffer;
-static _Thread_local AddrHash addr_map;
-static _Thread_local uint32_t tid;
-static _Thread_local bool spall_thread_running = false;
+#if defined(SPALL_AUTO_MALLOC) && !_WIN32
+// a dynamic TLS lookup can malloc, and the heap hooks can't have that
+#define SPALL_AUTO_TLS _Thread_local __attribute__((tls_model("initial-exec")))
+#else
+#define SPALL_AUTO_TLS _Thread_local
+#endif
+static SPALL_AUTO_TLS SpallBuffer spall_buffer;
+static SPALL_AUTO_TLS AddrHash addr_map;
+static SPALL_AUTO_TLS uint32_t tid;
+static SPALL_AUTO_TLS bool spall_thread_running = false;
+// functions entered while tracing was off (or inside one that was) and not exited yet.
+// A function's exit writes its End exactly when its entry wrote a Begin, whatever the flag says by then.
+static SPALL_AUTO_TLS uint32_t spall_auto__off_depth = 0;
+static SpallAutoFilter spall_auto__filter;
+#ifdef SPALL_AUTO_DEPTH
+// We always know how deep we are, so tag events with it and save the viewer from rebuilding the stack
+static SPALL_AUTO_TLS uint16_t spall_depth = 0;
+#endif
+#if !_WIN32
+// The TSC multiplier is a guess from a short calibration, so threads drop a clock sync every
+// SPALL_AUTO_CLOCK_SYNC_FLUSHES flushes (and at each end), for the viewer to correct the drift with
+#ifndef SPALL_AUTO_CLOCK_SYNC_FLUSHES
+#define SPALL_AUTO_CLOCK_SYNC_FLUSHES 64
+#endif
+static SPALL_AUTO_TLS uint64_t spall_auto__next_sync = 0;
+#endif
+#ifdef SPALL_AUTO_IO
+#ifndef SPALL_AUTO_IO_THRESHOLD_US
+#define SPALL_AUTO_IO_THRESHOLD_US 10
+#endif
+static uint64_t spall_auto__io_threshold; // in ticks, set up by spall_auto_init
+#endif
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -189,6 +257,14 @@ SPALL_FN bool get_addr_name(void *addr, Name *name_ret) {
 }
 #endif
 
+// names the filter turns down get cached with a negative length, so it only gets asked once per function
+SPALL_FN Name spall_auto__filter_name(Name name) {
+    if (spall_auto__filter && !spall_auto__filter(name.str, name.len)) {
+        name.len = -1;
+    }
+    return name;
+}
+
 SPALL_FN bool ah_insert(AddrHash *ah, void *addr, Name name) {
     int addr_hash = ah_hash(addr);
     uint64_t hv = ((uint64_t)addr_hash) & (ah->hashes.len - 1);
@@ -199,7 +275,7 @@ SPALL_FN bool ah_insert(AddrHash *ah, void *addr, Name name) {
         if (e_idx == -1) {
             SymEntry entry = { 0 };
             entry.addr = addr;
-            entry.name = name;
+            entry.name = spall_auto__filter_name(name);
                 
             ah->hashes.arr[idx] = ah->entries.len;
             ah->entries.arr[ah->entries.len] = entry;
@@ -230,6 +306,7 @@ SPALL_FN bool ah_get(AddrHash *ah, void *addr, Name *name_ret) {
                 // Failed to get a name for the address!
                 return false;
             }
+            name = spall_auto__filter_name(name);
 
             SymEntry entry = { 0 };
             entry.addr = addr;
@@ -513,19 +590,39 @@ void load_self(AddrHash *map) {
 
 #endif
 
+#if !_WIN32
+SPALL_FN double spall_auto__now(void) {
+    return (double)__rdtsc();
+}
+
+SPALL_FN SPALL_FORCEINLINE void spall_auto__periodic_sync(void) {
+    if (spall_buffer.stats.flushes < spall_auto__next_sync) return;
+    spall_auto__next_sync = spall_buffer.stats.flushes + SPALL_AUTO_CLOCK_SYNC_FLUSHES;
+    spall_buffer_clock_sync(&spall_ctx, &spall_buffer, spall_auto__now, 0);
+}
+#endif
+
 SPALL_NOINSTRUMENT SPALL_FORCEINLINE void (spall_auto_thread_init)(uint32_t _tid, size_t buffer_size, int64_t symbol_cache_size) {
     uint8_t *buffer = (uint8_t *)malloc(buffer_size);
     spall_buffer = { 0 };
     spall_buffer.data = buffer;
     spall_buffer.length = buffer_size;
+    spall_buffer.tag_blocks = true;
+    spall_buffer.tid = _tid;
+    spall_buffer.pid = 0;
 
     // removing initial page-fault bubbles to make the data a little more accurate, at the cost of thread spin-up time
     memset(buffer, 1, buffer_size);
 
     spall_buffer_init(&spall_ctx, &spall_buffer);
+#if !_WIN32
+    spall_buffer_clock_sync(&spall_ctx, &spall_buffer, spall_auto__now, 0);
+    spall_auto__next_sync = SPALL_AUTO_CLOCK_SYNC_FLUSHES;
+#endif
 
     tid = _tid;
     ah_init(&addr_map, symbol_cache_size);
+    spall_auto__off_depth = 0;
     spall_thread_running = true;
 }
 
@@ -535,12 +632,27 @@ void (spall_auto_thread_quit)(void) {
 #endif
     spall_thread_running = false;
     ah_free(&addr_map);
+#if !_WIN32
+    spall_buffer_clock_sync(&spall_ctx, &spall_buffer, spall_auto__now, 0);
+#endif
     spall_buffer_quit(&spall_ctx, &spall_buffer);
     free(spall_buffer.data);
 }
 
 void spall_auto_init(char *filename) {
     spall_ctx = spall_init_file_ex(filename, get_rdtsc_multiplier(), false);
+    spall_set_enabled_from_env(&spall_ctx);
+#ifdef SPALL_AUTO_TOGGLE_SIGNAL
+    spall_toggle_on_signal(&spall_ctx, SPALL_AUTO_TOGGLE_SIGNAL);
+#endif
+#ifdef SPALL_AUTO_IO
+    double io_threshold_us = SPALL_AUTO_IO_THRESHOLD_US;
+    char *io_threshold_env = getenv("SPALL_IO_THRESHOLD_US");
+    if (io_threshold_env) {
+        io_threshold_us = atof(io_threshold_env);
+    }
+    spall_auto__io_threshold = (uint64_t)(io_threshold_us / spall_ctx.timestamp_unit);
+#endif
     ah_init(&global_addr_map, 10000);
     load_self(&global_addr_map);
 #if _WIN32
@@ -564,6 +676,16 @@ void spall_auto_init(char *filename) {
 #endif
 }
 
+void spall_auto_set_enabled(bool enabled) {
+    spall_set_enabled(&spall_ctx, enabled);
+}
+
+#if !_WIN32 && !defined(SPALL_AUTO_PATCHABLE)
+void spall_auto_set_filter(SpallAutoFilter filter) {
+    spall_auto__filter = filter;
+}
+#endif
+
 void spall_auto_quit(void) {
 #if _WIN32
 #if _MSC_VER && !__clang__
@@ -581,6 +703,10 @@ SPALL_NOINSTRUMENT void __cyg_profile_func_enter(void *fn, void *caller) {
     if (!spall_thread_running) {
         return;
     }
+    if (!spall_ctx.enabled || spall_auto__off_depth) {
+        spall_auto__off_depth += 1;
+        return;
+    }
     spall_thread_running = false;
 
 #if _MSC_VER && !__clang__
@@ -597,9 +723,21 @@ SPALL_NOINSTRUMENT void __cyg_profile_func_enter(void *fn, void *caller) {
       name.str = (char *)not_found;
       name.len = sizeof(not_found) - 1;
     }
+    if (name.len < 0) {
+        spall_thread_running = true;
+        return;
+    }
 
     // printf("Begin: \"%s\"\n", name.str);
+#ifdef SPALL_AUTO_DEPTH
+    spall_buffer_begin_depth(&spall_ctx, &spall_buffer, name.str, name.len, (double)__rdtsc(), spall_depth, tid, 0);
+    spall_depth++;
+#else
     spall_buffer_begin_ex(&spall_ctx, &spall_buffer, name.str, name.len, (double)__rdtsc(), tid, 0);
+#endif
+#if !_WIN32
+    spall_auto__periodic_sync();
+#endif
     // spall_buffer_flush(&spall_ctx, &spall_buffer);
     // spall_flush(&spall_ctx);
     spall_thread_running = true;
@@ -609,9 +747,32 @@ SPALL_NOINSTRUMENT void __cyg_profile_func_exit(void *fn, void *caller) {
     if (!spall_thread_running) {
         return;
     }
+    if (spall_auto__off_depth) {
+        spall_auto__off_depth -= 1;
+        return;
+    }
     spall_thread_running = false;
 
+#if !_WIN32
+    // the filter's answer is cached with the name, so exits have to look it up too
+    if (spall_auto__filter) {
+        Name name;
+        if ((ah_get(&global_addr_map, fn, &name) || ah_get(&addr_map, fn, &name)) && name.len < 0) {
+            spall_thread_running = true;
+            return;
+        }
+    }
+#endif
+
     // printf("End\n");
+#ifdef SPALL_AUTO_DEPTH
+    // exits for functions we entered before tracing started have no begin to close
+    if (spall_depth == 0) {
+        spall_thread_running = true;
+        return;
+    }
+    spall_depth--;
+#endif
     spall_buffer_end_ex(&spall_ctx, &spall_buffer, (double)__rdtsc(), tid, 0);
     // spall_buffer_flush(&spall_ctx, &spall_buffer);
     // spall_flush(&spall_ctx);
@@ -733,6 +894,563 @@ PHOOK(_penter, 1, __cyg_profile_func_enter);
 PHOOK(_pexit, 0, __cyg_profile_func_exit);
 #endif
 
+#ifdef SPALL_AUTO_PATCHABLE
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "SPALL_AUTO_PATCHABLE only works on Linux x86-64 for now"
+#endif
+
+#include <sys/mman.h>
+
+/*
+    -fpatchable-function-entry=7,5 gives us 5 NOP bytes in front of each function and 2 at its entry.
+    Patching writes a call to spall_auto__entry_tramp into the 5 bytes in front (nothing runs there),
+    then swaps the 2 entry NOPs for a jmp back to that call in one store, so threads only ever see one or the other.
+
+        fn - 5: call spall_auto__entry_tramp
+        fn + 0: jmp fn - 5
+*/
+#define SPALL_AUTO_SLED_BEFORE 5
+#define SPALL_AUTO_SLED_SIZE   7
+#define SPALL_AUTO_SHADOW_DEPTH 4096
+
+extern void *__start___patchable_function_entries[] __attribute__((weak, visibility("hidden")));
+extern void *__stop___patchable_function_entries[] __attribute__((weak, visibility("hidden")));
+
+void spall_auto__entry_tramp(void);
+void spall_auto__exit_tramp(void);
+
+// Real return addresses of the patched functions we're inside, the stack has the exit trampoline instead
+static _Thread_local void *spall_auto__shadow[SPALL_AUTO_SHADOW_DEPTH];
+static _Thread_local uint32_t spall_auto__shadow_len = 0;
+
+SPALL_NOINSTRUMENT __attribute__((used, visibility("hidden"))) void spall_auto__patched_enter(void *fn, void **ret_slot) {
+    if (!spall_ctx.enabled || !spall_thread_running) {
+        return;
+    }
+    if (spall_auto__shadow_len >= SPALL_AUTO_SHADOW_DEPTH) {
+        return;
+    }
+
+    spall_auto__shadow[spall_auto__shadow_len++] = *ret_slot;
+    *ret_slot = (void *)spall_auto__exit_tramp;
+    __cyg_profile_func_enter(fn, NULL);
+}
+
+SPALL_NOINSTRUMENT __attribute__((used, visibility("hidden"))) void *spall_auto__patched_exit(void) {
+    void *ret = spall_auto__shadow[--spall_auto__shadow_len];
+    __cyg_profile_func_exit(NULL, NULL);
+    return ret;
+}
+
+// The C we call into is free to trash any vector register (glibc's AVX string functions end in vzeroupper,
+// which wipes the top of every ymm/zmm), so the trampolines save the extended state around it:
+// every xmm/ymm/zmm/mask register a patched function might be passing, and x87 for long double returns.
+// AMX tiles are left out, they're call-clobbered, and xrstor faults on them until the process asks for them.
+// xsave if the OS has it on, fxsave (x87 + xmm) if not. Set up by spall_auto__vector_state_init.
+#define SPALL_AUTO__XSAVE_COMPONENTS 0xE7 // x87, sse, avx, opmask, zmm_hi256, hi16_zmm
+__attribute__((used, visibility("hidden"))) uint64_t spall_auto__xsave_size = 512;
+__attribute__((used, visibility("hidden"))) uint32_t spall_auto__xsave_mask = 0;
+__attribute__((used, visibility("hidden"))) uint8_t spall_auto__has_xsave = 0;
+
+#include <cpuid.h>
+SPALL_FN void spall_auto__vector_state_init(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) return;
+    if (__get_cpuid_max(0, NULL) < 0xD) return;
+
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    uint32_t mask = xcr0_lo & SPALL_AUTO__XSAVE_COMPONENTS;
+
+    // legacy area + header, then wherever the furthest component we save ends
+    uint64_t size = 576;
+    for (int i = 2; i < 8; i++) {
+        if (!(mask & (1u << i))) continue;
+        __cpuid_count(0xD, i, eax, ebx, ecx, edx);
+        if (ebx + eax > size) size = ebx + eax;
+    }
+    spall_auto__xsave_size = (size + 63) & ~63ull;
+    spall_auto__xsave_mask = mask;
+    spall_auto__has_xsave = 1;
+}
+
+// Expects the area's size in %r11, leaves %rsp pointing at it (64 byte aligned) and %rbx at where it was,
+// clobbers %eax/%edx, so they need saving first
+#define SPALL_AUTO__SAVE_VECTORS \
+    "    pushq %rbx\n" \
+    "    movq %rsp, %rbx\n" \
+    "    subq %r11, %rsp\n" \
+    "    andq $-64, %rsp\n" \
+    "    cmpb $0, spall_auto__has_xsave(%rip)\n" \
+    "    je 1f\n" \
+    /* xrstor faults on anything stray in the xsave header, and xsave leaves all but our mask's bits as they were */ \
+    "    movq $0, 512(%rsp)\n" \
+    "    movq $0, 520(%rsp)\n" \
+    "    movq $0, 528(%rsp)\n" \
+    "    movq $0, 536(%rsp)\n" \
+    "    movq $0, 544(%rsp)\n" \
+    "    movq $0, 552(%rsp)\n" \
+    "    movq $0, 560(%rsp)\n" \
+    "    movq $0, 568(%rsp)\n" \
+    "    movl spall_auto__xsave_mask(%rip), %eax\n" \
+    "    xorl %edx, %edx\n" \
+    "    xsave64 (%rsp)\n" \
+    "    jmp 2f\n" \
+    "1:  fxsave64 (%rsp)\n" \
+    "2:\n"
+
+// Undoes SPALL_AUTO__SAVE_VECTORS, clobbers %eax/%edx
+#define SPALL_AUTO__RESTORE_VECTORS \
+    "    cmpb $0, spall_auto__has_xsave(%rip)\n" \
+    "    je 1f\n" \
+    "    movl spall_auto__xsave_mask(%rip), %eax\n" \
+    "    xorl %edx, %edx\n" \
+    "    xrstor64 (%rsp)\n" \
+    "    jmp 2f\n" \
+    "1:  fxrstor64 (%rsp)\n" \
+    "2:  movq %rbx, %rsp\n" \
+    "    popq %rbx\n"
+
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl spall_auto__entry_tramp\n"
+    ".hidden spall_auto__entry_tramp\n"
+    "spall_auto__entry_tramp:\n"
+    // [rsp] = fn, [rsp + 8] = fn's return address. The stack might not be aligned,
+    // gcc skips aligning calls to functions it knows don't care, so realign it ourselves.
+    // r11 is free at a function's entry (it's what PLT stubs and the like scratch with).
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    andq $-16, %rsp\n"
+    "    pushq %rax\n"
+    "    pushq %rdi\n"
+    "    pushq %rsi\n"
+    "    pushq %rdx\n"
+    "    pushq %rcx\n"
+    "    pushq %r8\n"
+    "    pushq %r9\n"
+    "    pushq %r10\n"
+    "    movq spall_auto__xsave_size(%rip), %r11\n"
+    SPALL_AUTO__SAVE_VECTORS
+    "    movq 8(%rbp), %rdi\n"
+    "    leaq 16(%rbp), %rsi\n"
+    "    call spall_auto__patched_enter\n"
+    SPALL_AUTO__RESTORE_VECTORS
+    "    popq %r10\n"
+    "    popq %r9\n"
+    "    popq %r8\n"
+    "    popq %rcx\n"
+    "    popq %rdx\n"
+    "    popq %rsi\n"
+    "    popq %rdi\n"
+    "    popq %rax\n"
+    "    movq %rbp, %rsp\n"
+    "    popq %rbp\n"
+    "    addq $2, (%rsp)\n" // come back in after the jmp
+    "    ret\n"
+
+    ".p2align 4\n"
+    ".globl spall_auto__exit_tramp\n"
+    ".hidden spall_auto__exit_tramp\n"
+    "spall_auto__exit_tramp:\n"
+    // a patched function just returned here, so it's the return registers that matter now:
+    // rax/rdx, and the vector and x87 state (xmm0/xmm1, wider for __m256/__m512, st0 for long double)
+    "    subq $8, %rsp\n" // the real return address goes here
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    andq $-16, %rsp\n"
+    "    pushq %rax\n"
+    "    pushq %rdx\n"
+    "    movq spall_auto__xsave_size(%rip), %r11\n"
+    SPALL_AUTO__SAVE_VECTORS
+    "    call spall_auto__patched_exit\n"
+    "    movq %rax, 8(%rbp)\n"
+    SPALL_AUTO__RESTORE_VECTORS
+    "    popq %rdx\n"
+    "    popq %rax\n"
+    "    movq %rbp, %rsp\n"
+    "    popq %rbp\n"
+    "    ret\n"
+);
+
+SPALL_FN bool spall_auto__sled_is_nop(uint8_t *entry) {
+    return (entry[0] == 0x90 && entry[1] == 0x90) || (entry[0] == 0x66 && entry[1] == 0x90);
+}
+
+SPALL_FN void spall_auto__store_entry(uint8_t *entry, uint16_t bytes) {
+    // one store, so no thread can see half of it (it's fine unaligned, as long as it's within a cache line)
+    __asm__ volatile("movw %1, (%0)" :: "r"(entry), "r"(bytes) : "memory");
+}
+
+SPALL_FN bool spall_auto__unprotect_sleds(int prot) {
+    void **start = __start___patchable_function_entries;
+    void **stop = __stop___patchable_function_entries;
+
+    uintptr_t lo = UINTPTR_MAX;
+    uintptr_t hi = 0;
+    for (void **sled = start; sled < stop; sled++) {
+        uintptr_t addr = (uintptr_t)*sled;
+        lo = addr < lo ? addr : lo;
+        hi = (addr + SPALL_AUTO_SLED_SIZE) > hi ? (addr + SPALL_AUTO_SLED_SIZE) : hi;
+    }
+
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    lo = lo & ~(page_size - 1);
+    hi = (hi + page_size - 1) & ~(page_size - 1);
+
+    // the code has to stay executable the whole time, other threads are still running it
+    return mprotect((void *)lo, hi - lo, prot) == 0;
+}
+
+// Returns how many functions got patched, or -1 if we couldn't make the code writable
+SPALL_NOINSTRUMENT int spall_auto_patch(SpallAutoFilter filter) {
+    void **start = __start___patchable_function_entries;
+    void **stop = __stop___patchable_function_entries;
+    if (!start || start == stop) {
+        return 0;
+    }
+    spall_auto__vector_state_init();
+
+    if (!spall_auto__unprotect_sleds(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        return -1;
+    }
+
+    int patched = 0;
+    for (void **sled_ptr = start; sled_ptr < stop; sled_ptr++) {
+        uint8_t *sled = (uint8_t *)*sled_ptr;
+        uint8_t *entry = sled + SPALL_AUTO_SLED_BEFORE;
+
+        if (((uintptr_t)entry & 63) == 63 || !spall_auto__sled_is_nop(entry)) {
+            continue;
+        }
+
+        if (filter) {
+            Name name;
+            if (!ah_get(&global_addr_map, entry, &name) || !filter(name.str, name.len)) {
+                continue;
+            }
+        }
+
+        int64_t rel = (int64_t)(uintptr_t)spall_auto__entry_tramp - (int64_t)(uintptr_t)(sled + 5);
+        if (rel < INT32_MIN || rel > INT32_MAX) {
+            continue;
+        }
+        int32_t rel32 = (int32_t)rel;
+
+        sled[0] = 0xE8; // call rel32
+        memcpy(sled + 1, &rel32, sizeof(rel32));
+        spall_auto__store_entry(entry, 0xF9EB); // jmp -7
+        patched++;
+    }
+
+    spall_auto__unprotect_sleds(PROT_READ | PROT_EXEC);
+    return patched;
+}
+
+// Returns how many functions went back to NOPs. Anything still running keeps its exit hook until it returns.
+SPALL_NOINSTRUMENT int spall_auto_unpatch(void) {
+    void **start = __start___patchable_function_entries;
+    void **stop = __stop___patchable_function_entries;
+    if (!start || start == stop) {
+        return 0;
+    }
+
+    if (!spall_auto__unprotect_sleds(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        return -1;
+    }
+
+    int unpatched = 0;
+    for (void **sled_ptr = start; sled_ptr < stop; sled_ptr++) {
+        uint8_t *entry = (uint8_t *)*sled_ptr + SPALL_AUTO_SLED_BEFORE;
+        if (entry[0] == 0xEB && entry[1] == 0xF9) {
+            spall_auto__store_entry(entry, 0x9066); // 2 byte nop
+            unpatched++;
+        }
+    }
+
+    spall_auto__unprotect_sleds(PROT_READ | PROT_EXEC);
+    return unpatched;
+}
+#endif
+
+#ifdef SPALL_AUTO_MALLOC
+#if !defined(__linux__)
+#error "SPALL_AUTO_MALLOC only works on Linux for now"
+#endif
+
+#include <malloc.h>
+#include <errno.h>
+
+// glibc exports its allocator under these too, so we don't need dlsym (which allocates) to find it
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void  __libc_free(void *ptr);
+
+// Everything we (or spall.h, or a flush) allocate happens with spall_thread_running off,
+// so it goes straight through instead of recursing back in here
+SPALL_FN void spall_auto__heap_event(uint8_t type, void *ptr, void *site) {
+    if (!ptr || !spall_ctx.enabled || !spall_thread_running) {
+        return;
+    }
+    spall_thread_running = false;
+
+    spall__buffer_alloc(&spall_ctx, &spall_buffer, type, ptr, malloc_usable_size(ptr), site, (double)__rdtsc(), tid, 0);
+
+    spall_thread_running = true;
+}
+
+SPALL_NOINSTRUMENT void *malloc(size_t size) __THROW {
+    void *ptr = __libc_malloc(size);
+    spall_auto__heap_event(SpallEventType_Alloc, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+SPALL_NOINSTRUMENT void *calloc(size_t count, size_t size) __THROW {
+    void *ptr = __libc_calloc(count, size);
+    spall_auto__heap_event(SpallEventType_Alloc, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+SPALL_NOINSTRUMENT void *realloc(void *ptr, size_t size) __THROW {
+    // the old block might get handed back, so it has to go out before we know
+    spall_auto__heap_event(SpallEventType_Free, ptr, __builtin_return_address(0));
+    void *new_ptr = __libc_realloc(ptr, size);
+
+    // and if it fails, the old block is still there
+    spall_auto__heap_event(SpallEventType_Alloc, (new_ptr || !size) ? new_ptr : ptr, __builtin_return_address(0));
+    return new_ptr;
+}
+
+SPALL_NOINSTRUMENT void *memalign(size_t align, size_t size) __THROW {
+    void *ptr = __libc_memalign(align, size);
+    spall_auto__heap_event(SpallEventType_Alloc, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+SPALL_NOINSTRUMENT void *aligned_alloc(size_t align, size_t size) __THROW {
+    void *ptr = __libc_memalign(align, size);
+    spall_auto__heap_event(SpallEventType_Alloc, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+SPALL_NOINSTRUMENT int posix_memalign(void **ptr_ret, size_t align, size_t size) __THROW {
+    if (align < sizeof(void *) || (align & (align - 1))) {
+        return EINVAL;
+    }
+
+    void *ptr = __libc_memalign(align, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    spall_auto__heap_event(SpallEventType_Alloc, ptr, __builtin_return_address(0));
+    *ptr_ret = ptr;
+    return 0;
+}
+
+SPALL_NOINSTRUMENT void free(void *ptr) __THROW {
+    spall_auto__heap_event(SpallEventType_Free, ptr, __builtin_return_address(0));
+    __libc_free(ptr);
+}
+#endif
+
+#ifdef SPALL_AUTO_LOCKS
+#if !defined(__linux__)
+#error "SPALL_AUTO_LOCKS only works on Linux for now"
+#endif
+
+#include <errno.h>
+
+typedef int (*spall_auto__lock_fn)(void *lock);
+typedef int (*spall_auto__cond_wait_fn)(pthread_cond_t *cond, pthread_mutex_t *mutex);
+typedef int (*spall_auto__cond_timedwait_fn)(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
+
+static spall_auto__lock_fn real_mutex_lock;
+static spall_auto__lock_fn real_rwlock_rdlock;
+static spall_auto__lock_fn real_rwlock_wrlock;
+static spall_auto__cond_wait_fn real_cond_wait;
+static spall_auto__cond_timedwait_fn real_cond_timedwait;
+
+// Racing threads all find the same answers, so there's nothing to guard here
+SPALL_FN void *spall_auto__find_real(void *fn, const char *name, const char *version) {
+    if (fn) {
+        return fn;
+    }
+
+    // plain dlsym hands back the pre-2.3.2 condvars, which don't mix with the ones everyone else gets
+    if (version) {
+        fn = dlvsym(RTLD_NEXT, name, version);
+    }
+    if (!fn) {
+        fn = dlsym(RTLD_NEXT, name);
+    }
+    return fn;
+}
+
+SPALL_FN bool spall_auto__wait_begin(const char *name, int name_len, void *lock) {
+    if (!spall_ctx.enabled || !spall_thread_running) {
+        return false;
+    }
+    spall_thread_running = false;
+
+    // the name stays fixed so every wait lands in one stats row, the viewer splits them back out per lock
+    char args[256];
+    int args_len;
+    Dl_info info;
+    if (dladdr(lock, &info) != 0 && info.dli_sname != NULL && info.dli_saddr == lock) {
+        args_len = snprintf(args, sizeof(args), "{\"lock\":\"%s\"}", info.dli_sname);
+    } else {
+        args_len = snprintf(args, sizeof(args), "{\"lock\":\"%p\"}", lock);
+    }
+    args_len = SPALL_MIN(args_len, (int)sizeof(args) - 1);
+
+#ifdef SPALL_AUTO_DEPTH
+    spall_buffer_begin_depth_args(&spall_ctx, &spall_buffer, name, name_len, args, args_len, (double)__rdtsc(), spall_depth, tid, 0);
+    spall_depth++;
+#else
+    spall_buffer_begin_args(&spall_ctx, &spall_buffer, name, name_len, args, args_len, (double)__rdtsc(), tid, 0);
+#endif
+    return true;
+}
+
+SPALL_FN void spall_auto__wait_end(void) {
+#ifdef SPALL_AUTO_DEPTH
+    spall_depth--;
+#endif
+    spall_buffer_end_ex(&spall_ctx, &spall_buffer, (double)__rdtsc(), tid, 0);
+    spall_thread_running = true;
+}
+
+#define SPALL_AUTO__WAIT(name, lock, call) \
+    bool traced = spall_auto__wait_begin(name, sizeof(name) - 1, lock); \
+    int ret = call; \
+    if (traced) spall_auto__wait_end(); \
+    return ret
+
+SPALL_NOINSTRUMENT int pthread_mutex_lock(pthread_mutex_t *mutex) __THROW {
+    real_mutex_lock = (spall_auto__lock_fn)spall_auto__find_real((void *)real_mutex_lock, "pthread_mutex_lock", NULL);
+    if (!spall_ctx.enabled || !spall_thread_running) {
+        return real_mutex_lock(mutex);
+    }
+
+    int busy = pthread_mutex_trylock(mutex);
+    if (busy != EBUSY) {
+        return busy;
+    }
+
+    SPALL_AUTO__WAIT("mutex wait", mutex, real_mutex_lock(mutex));
+}
+
+SPALL_NOINSTRUMENT int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) __THROW {
+    real_rwlock_rdlock = (spall_auto__lock_fn)spall_auto__find_real((void *)real_rwlock_rdlock, "pthread_rwlock_rdlock", NULL);
+    if (!spall_ctx.enabled || !spall_thread_running) {
+        return real_rwlock_rdlock(rwlock);
+    }
+
+    int busy = pthread_rwlock_tryrdlock(rwlock);
+    if (busy != EBUSY) {
+        return busy;
+    }
+
+    SPALL_AUTO__WAIT("rwlock read wait", rwlock, real_rwlock_rdlock(rwlock));
+}
+
+SPALL_NOINSTRUMENT int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) __THROW {
+    real_rwlock_wrlock = (spall_auto__lock_fn)spall_auto__find_real((void *)real_rwlock_wrlock, "pthread_rwlock_wrlock", NULL);
+    if (!spall_ctx.enabled || !spall_thread_running) {
+        return real_rwlock_wrlock(rwlock);
+    }
+
+    int busy = pthread_rwlock_trywrlock(rwlock);
+    if (busy != EBUSY) {
+        return busy;
+    }
+
+    SPALL_AUTO__WAIT("rwlock write wait", rwlock, real_rwlock_wrlock(rwlock));
+}
+
+// condvars don't have a fast path, every wait is a wait
+SPALL_NOINSTRUMENT int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    real_cond_wait = (spall_auto__cond_wait_fn)spall_auto__find_real((void *)real_cond_wait, "pthread_cond_wait", "GLIBC_2.3.2");
+    SPALL_AUTO__WAIT("cond wait", cond, real_cond_wait(cond, mutex));
+}
+
+SPALL_NOINSTRUMENT int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) {
+    real_cond_timedwait = (spall_auto__cond_timedwait_fn)spall_auto__find_real((void *)real_cond_timedwait, "pthread_cond_timedwait", "GLIBC_2.3.2");
+    SPALL_AUTO__WAIT("cond wait", cond, real_cond_timedwait(cond, mutex, abstime));
+}
+#undef SPALL_AUTO__WAIT
+#endif
+
+#ifdef SPALL_AUTO_IO
+#if !defined(__linux__)
+#error "SPALL_AUTO_IO only works on Linux for now"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Written after the fact as a complete, since we don't know if it's worth keeping until the call's done
+SPALL_FN void spall_auto__io_zone(const char *name, int name_len, uint64_t start, int fd, long long bytes) {
+    uint64_t end = __rdtsc();
+    if (end - start < spall_auto__io_threshold) {
+        return;
+    }
+
+    // whoever called us is about to look at errno, and a flush could stomp on it
+    int saved_errno = errno;
+    spall_thread_running = false;
+
+    char args[64];
+    int args_len = 0;
+    if (fd >= 0) {
+        args_len = snprintf(args, sizeof(args), "{\"fd\":%d,\"bytes\":%lld}", fd, bytes);
+    }
+
+#ifdef SPALL_AUTO_DEPTH
+    spall_buffer_complete_depth_args(&spall_ctx, &spall_buffer, name, name_len, args, args_len, (double)start, (double)(end - start), spall_depth, tid, 0);
+#else
+    spall_buffer_complete_args(&spall_ctx, &spall_buffer, name, name_len, args, args_len, (double)start, (double)(end - start), tid, 0);
+#endif
+
+    spall_thread_running = true;
+    errno = saved_errno;
+}
+
+#define SPALL_AUTO__IO(ret_type, fn, params, call_args, fd) \
+    SPALL_NOINSTRUMENT ret_type fn params { \
+        static ret_type (*real) params; \
+        if (!real) real = (ret_type (*) params)dlsym(RTLD_NEXT, #fn); \
+        if (!spall_ctx.enabled || !spall_thread_running) return real call_args; \
+        uint64_t start = __rdtsc(); \
+        ret_type ret = real call_args; \
+        spall_auto__io_zone(#fn, sizeof(#fn) - 1, start, fd, (long long)ret); \
+        return ret; \
+    }
+
+SPALL_AUTO__IO(ssize_t, read,     (int fd, void *buf, size_t count),                    (fd, buf, count),                fd)
+SPALL_AUTO__IO(ssize_t, write,    (int fd, const void *buf, size_t count),              (fd, buf, count),                fd)
+SPALL_AUTO__IO(ssize_t, pread,    (int fd, void *buf, size_t count, off_t offset),       (fd, buf, count, offset),        fd)
+SPALL_AUTO__IO(ssize_t, pwrite,   (int fd, const void *buf, size_t count, off_t offset), (fd, buf, count, offset),        fd)
+SPALL_AUTO__IO(ssize_t, readv,    (int fd, const struct iovec *iov, int iovcnt),         (fd, iov, iovcnt),               fd)
+SPALL_AUTO__IO(ssize_t, writev,   (int fd, const struct iovec *iov, int iovcnt),         (fd, iov, iovcnt),               fd)
+SPALL_AUTO__IO(ssize_t, recv,     (int fd, void *buf, size_t len, int flags),            (fd, buf, len, flags),           fd)
+SPALL_AUTO__IO(ssize_t, send,     (int fd, const void *buf, size_t len, int flags),      (fd, buf, len, flags),           fd)
+SPALL_AUTO__IO(ssize_t, recvfrom, (int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addr_len), (fd, buf, len, flags, addr, addr_len), fd)
+SPALL_AUTO__IO(ssize_t, sendto,   (int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addr_len), (fd, buf, len, flags, addr, addr_len), fd)
+SPALL_AUTO__IO(int,     fsync,    (int fd),                                             (fd),                            fd)
+SPALL_AUTO__IO(int,     fdatasync, (int fd),                                            (fd),                            fd)
+SPALL_AUTO__IO(int,     poll,     (struct pollfd *fds, nfds_t nfds, int timeout),        (fds, nfds, timeout),            -1)
+SPALL_AUTO__IO(int,     nanosleep, (const struct timespec *req, struct timespec *rem),   (req, rem),                      -1)
+SPALL_AUTO__IO(int,     usleep,   (useconds_t usec),                                    (usec),                          -1)
+SPALL_AUTO__IO(unsigned int, sleep, (unsigned int seconds),                             (seconds),                       -1)
+#undef SPALL_AUTO__IO
+#endif
+
 #ifdef __cplusplus
 }
 #endif
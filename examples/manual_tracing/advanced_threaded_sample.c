@@ -91,9 +91,16 @@ void *run_work(void *ptr) {
 	#define BUFFER_SIZE (100 * 1024 * 1024)
 	unsigned char *buffer = malloc(BUFFER_SIZE);
 
+	/*
+		Everything this buffer sees is on our tid, so we can tag each flush with it.
+		The viewer then only has to look the thread up once per flush, instead of once per event.
+	*/
 	spall_buffer = (SpallBuffer){
 		.length = BUFFER_SIZE,
 		.data = buffer,
+		.tag_blocks = true,
+		.tid = tid,
+		.pid = 0,
 	};
 
 	/*
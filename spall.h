@@ -24,18 +24,64 @@ TODO: Optional Helper APIs:
 #define SPALL_H
 
 #if !defined(_MSC_VER) || defined(__clang__)
+#if defined(__has_attribute) && __has_attribute(patchable_function_entry)
+// also keep -fpatchable-function-entry sleds out of our own functions
+#define SPALL_NOINSTRUMENT __attribute__((no_instrument_function, patchable_function_entry(0, 0)))
+#else
 #define SPALL_NOINSTRUMENT __attribute__((no_instrument_function))
+#endif
 #define SPALL_FORCEINLINE __attribute__((always_inline))
+#define SPALL_NOINLINE __attribute__((noinline, unused)) // for static, non-inline helpers that not every includer calls
 #else
 #define _CRT_SECURE_NO_WARNINGS
 #define SPALL_NOINSTRUMENT // Can't noinstrument on MSVC!
 #define SPALL_FORCEINLINE __forceinline
+#define SPALL_NOINLINE __declspec(noinline)
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <math.h>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <poll.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(SPALL_PERCPU)
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "SPALL_PERCPU needs rseq, and spall only knows how to use it on x86-64 Linux"
+#endif
+#include <pthread.h>
+#include <sys/rseq.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <linux/membarrier.h>
+#endif
+
+// Hardware CRC32C for block checksums, if the target has it (AVX implies SSE4.2 on MSVC)
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__SSE4_2__) || defined(__AVX__))
+#include <nmmintrin.h>
+#define SPALL_CRC32C_X64
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define SPALL_CRC32C_ARM
+#endif
 
 #define SPALL_FN static inline SPALL_NOINSTRUMENT
 
@@ -57,9 +103,28 @@ enum {
 
     SpallEventType_Begin               = 3,
     SpallEventType_End                 = 4,
-    SpallEventType_Instant             = 5,
+    SpallEventType_Instant             = 5, // A point in time on a thread, ie: the writer's "N events dropped" markers
 
     SpallEventType_Overwrite_Timestamp = 6, // Retroactively change timestamp units - useful for incrementally improving RDTSC frequency.
+
+    SpallEventType_Complete            = 7, // Begin + End in one record, when you already know both times
+
+    SpallEventType_Depth_Begin         = 8, // Begin/Complete that carry their own call depth, so readers
+    SpallEventType_Depth_Complete      = 9, // don't have to rebuild the nesting with a stack
+
+    SpallEventType_Block               = 10, // Wraps one buffer flush worth of events from a single pid/tid
+
+    SpallEventType_Sampled_Begin       = 11, // Begin that stands in for sample_rate instances, closed by a normal End
+
+    SpallEventType_Clock_Sync          = 12, // Pairs a trace timestamp with the system clocks, so readers can line up processes
+
+    SpallEventType_Name_Process        = 13, // Names a pid (and/or moves it around), once is enough
+    SpallEventType_Name_Thread         = 14, // Names a pid/tid (and/or moves it around), once is enough
+
+    SpallEventType_Alloc               = 15, // Heap traffic, for tracking live bytes and who allocated them
+    SpallEventType_Free                = 16,
+
+    SpallEventType_Fiber_Switch        = 17, // Moves a thread onto another fiber/coroutine, its events follow it there
 };
 
 typedef struct SpallBeginEvent {
@@ -87,34 +152,320 @@ typedef struct SpallEndEvent {
     double   when;
 } SpallEndEvent;
 
+typedef struct SpallInstantEvent {
+    uint8_t type; // = SpallEventType_Instant
+    uint8_t category;
+
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+
+    uint8_t name_length;
+    uint8_t args_length;
+} SpallInstantEvent;
+
+typedef struct SpallInstantEventMax {
+    SpallInstantEvent event;
+    char name_bytes[255];
+    char args_bytes[255];
+} SpallInstantEventMax;
+
+// Completes don't get matched against anything, they land as a child of
+// whatever begin is open on their pid/tid when they're read.
+// Like begins, they need to be written in start-time order per pid/tid,
+// and they need to end before the next event on that pid/tid starts.
+typedef struct SpallCompleteEvent {
+    uint8_t type; // = SpallEventType_Complete
+    uint8_t category;
+
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+    double   duration;
+
+    uint8_t name_length;
+    uint8_t args_length;
+} SpallCompleteEvent;
+
+typedef struct SpallCompleteEventMax {
+    SpallCompleteEvent event;
+    char name_bytes[255];
+    char args_bytes[255];
+} SpallCompleteEventMax;
+
+// Depth records put the event at an explicit call depth (0 = outermost).
+// An End closes the last event opened at the deepest open depth on its pid/tid.
+// Events at each depth need to be in start-time order, but a Depth_Complete
+// can come after its children (ie: written when the function returns).
+// Don't mix these with plain Begins while plain Begins are still open on a pid/tid.
+typedef struct SpallDepthBeginEvent {
+    uint8_t type; // = SpallEventType_Depth_Begin
+    uint8_t category;
+
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+    uint16_t depth;
+
+    uint8_t name_length;
+    uint8_t args_length;
+} SpallDepthBeginEvent;
+
+typedef struct SpallDepthBeginEventMax {
+    SpallDepthBeginEvent event;
+    char name_bytes[255];
+    char args_bytes[255];
+} SpallDepthBeginEventMax;
+
+typedef struct SpallDepthCompleteEvent {
+    uint8_t type; // = SpallEventType_Depth_Complete
+    uint8_t category;
+
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+    double   duration;
+    uint16_t depth;
+
+    uint8_t name_length;
+    uint8_t args_length;
+} SpallDepthCompleteEvent;
+
+typedef struct SpallDepthCompleteEventMax {
+    SpallDepthCompleteEvent event;
+    char name_bytes[255];
+    char args_bytes[255];
+} SpallDepthCompleteEventMax;
+
+// Written for 1 out of every sample_rate instances of a zone, the viewer
+// scales its stats (count, total time, self time) back up by sample_rate.
+// Keep a name either sampled or not, the rate sticks to the name, not the instance.
+typedef struct SpallSampledBeginEvent {
+    uint8_t type; // = SpallEventType_Sampled_Begin
+    uint8_t category;
+
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+    uint32_t sample_rate;
+
+    uint8_t name_length;
+    uint8_t args_length;
+} SpallSampledBeginEvent;
+
+typedef struct SpallSampledBeginEventMax {
+    SpallSampledBeginEvent event;
+    char name_bytes[255];
+    char args_bytes[255];
+} SpallSampledBeginEventMax;
+
+// Written in front of each flush from a buffer with tag_blocks set.
+// Every event in the block is on pid/tid, so readers can hand whole blocks to one worker per thread.
+// The magic lets readers find the next block after garbage, and the CRC32C
+// (over the header with crc = 0, then the events) tells them which blocks to throw out.
+#define SPALL_BLOCK_MAGIC 0x4B4C4253 // "SBLK"
+#define SPALL_MAX_BLOCK_SIZE (64 * 1024 * 1024) // readers treat a longer length as corrupt
+typedef struct SpallBlockHeader {
+    uint8_t  type; // = SpallEventType_Block
+    uint32_t magic; // = SPALL_BLOCK_MAGIC
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t length; // bytes of events following the header
+    uint32_t crc;
+    double   min_when;
+    double   max_when;
+} SpallBlockHeader;
+
+// A few of these per process (ie: at startup, at shutdown, and every so often in between)
+// let readers fit each pid's clock onto CLOCK_MONOTONIC, so processes that calibrated their
+// timestamp_unit separately, or that read raw TSCs, still line up with each other.
+// realtime_ns is there for lining up traces from different machines (or boots).
+typedef struct SpallClockSyncEvent {
+    uint8_t  type; // = SpallEventType_Clock_Sync
+    uint32_t pid;
+    double   when;
+    uint64_t monotonic_ns;
+    uint64_t realtime_ns;
+} SpallClockSyncEvent;
+
+// Naming records can go anywhere in the trace, and the last one for a pid (or pid/tid) wins.
+// Tracks go lowest sort_index first, and ties (ie: everything left at 0) go by start time.
+// An empty name just sets the sort_index.
+// If you write these into a buffer with tag_blocks set, only name that buffer's own pid/tid.
+typedef struct SpallNameProcessEvent {
+    uint8_t  type; // = SpallEventType_Name_Process
+    uint32_t pid;
+    int32_t  sort_index;
+    uint8_t  name_length;
+} SpallNameProcessEvent;
+
+typedef struct SpallNameProcessEventMax {
+    SpallNameProcessEvent event;
+    char name_bytes[255];
+} SpallNameProcessEventMax;
+
+typedef struct SpallNameThreadEvent {
+    uint8_t  type; // = SpallEventType_Name_Thread
+    uint32_t pid;
+    uint32_t tid;
+    int32_t  sort_index;
+    uint8_t  name_length;
+} SpallNameThreadEvent;
+
+typedef struct SpallNameThreadEventMax {
+    SpallNameThreadEvent event;
+    char name_bytes[255];
+} SpallNameThreadEventMax;
+
+// Allocs and frees share a layout. size is whatever the allocator really handed out
+// (ie: malloc_usable_size), so a free can carry its own size and readers don't have to
+// match it up with its alloc. site is the caller's return address, 0 if you don't know it.
+typedef struct SpallAllocEvent {
+    uint8_t  type; // = SpallEventType_Alloc or SpallEventType_Free
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+    uint64_t addr;
+    uint64_t size;
+    uint64_t site;
+} SpallAllocEvent;
+
+// Everything tid writes after this belongs to fiber, until its next switch, so a fiber's zones can
+// start on one thread and end on another. fiber 0 is the thread's own stack.
+typedef struct SpallFiberSwitchEvent {
+    uint8_t  type; // = SpallEventType_Fiber_Switch
+    uint32_t pid;
+    uint32_t tid;
+    double   when;
+    uint32_t fiber;
+} SpallFiberSwitchEvent;
+
 #pragma pack(pop)
 
 typedef struct SpallProfile SpallProfile;
+typedef struct SpallBuffer SpallBuffer;
+#if defined(SPALL_PERCPU)
+typedef struct SpallCpuBuffers SpallCpuBuffers;
+#endif
+
+// What tracing has cost so far. Each buffer keeps its own (plain, unsynchronized) counters,
+// so the hot path never touches anything shared, and spall_get_stats adds them all up.
+typedef struct SpallStats {
+    uint64_t events;    // events that made it into a buffer
+    uint64_t bytes;     // bytes handed to the write callback
+    uint64_t flushes;
+    double flush_us;    // total time spent in the write callback
+    double max_flush_us;
+    uint64_t dropped;   // events lost to a failed flush/write
+    uint64_t truncated; // events with a name or args cut down to 255 bytes
+} SpallStats;
 
 // Important!: If you define your own callbacks, mark them SPALL_NOINSTRUMENT!
 typedef bool (*SpallWriteCallback)(SpallProfile *self, const void *data, size_t length);
 typedef bool (*SpallFlushCallback)(SpallProfile *self);
 typedef void (*SpallCloseCallback)(SpallProfile *self);
+typedef void (*SpallStatsCallback)(SpallProfile *self, const SpallStats *stats);
+
+// What to do when the sink can't keep up (ie: its write callback returns false).
+// Either way, a begin that gets dropped takes its end (and everything between) with it,
+// and the next flush that goes through writes an "N events dropped" instant.
+typedef enum SpallBackpressure {
+    SpallBackpressure_Block = 0,   // wait on the sink, and only drop if it fails outright
+    SpallBackpressure_Drop_Newest, // keep what's buffered, and drop new events until the sink catches up
+    SpallBackpressure_Drop_Oldest, // throw out finished events from the buffer to make room (binary only, JSON drops newest)
+} SpallBackpressure;
 
 struct SpallProfile {
     double timestamp_unit;
     bool is_json;
+    volatile bool enabled; // checked once per event, flip it with spall_set_enabled
     SpallWriteCallback write;
     SpallFlushCallback flush;
     SpallCloseCallback close;
     void *data;
+
+    // Optional: gets the totals from spall_report_stats, and once more from spall_quit
+    SpallStatsCallback on_stats;
+
+    // Optional: set before any buffers start writing. The fd and shm sinks stop waiting
+    // on their reader under the drop policies, custom sinks can check it too.
+    SpallBackpressure backpressure;
+
+    // Internal data - don't assign this
+    SpallBuffer *buffers; // everything between spall_buffer_init and spall_buffer_quit
+    SpallStats retired;   // what the buffers that already quit left behind
+    volatile long buffers_lock;
 };
 
 // Important!: If you are writing Begin/End events, then do NOT write
 //             events for the same PID + TID pair on different buffers!!!
-typedef struct SpallBuffer {
+struct SpallBuffer {
     void *data;
     size_t length;
 
+    // Optional: wrap every flush in a block tagged with this pid/tid (binary only).
+    // Only set this if every event you write into the buffer uses the same pid/tid,
+    // and set it before spall_buffer_init. Blocks top out at SPALL_MAX_BLOCK_SIZE,
+    // so spall_buffer_init trims length down to fit, if it has to.
+    bool tag_blocks;
+    uint32_t pid;
+    uint32_t tid;
+
+#if defined(SPALL_PERCPU)
+    // Optional: send every event on to whichever cpu we're on, instead of holding onto them here.
+    // data only has to fit one event then (SPALL_CPU_STAGING_SIZE), and tag_blocks has to stay off.
+    SpallCpuBuffers *cpus;
+#endif
+
     // Internal data - don't assign this
     size_t head;
     SpallProfile *ctx;
-} SpallBuffer;
+    double block_min_when;
+    double block_max_when;
+    SpallStats stats;
+    SpallBuffer *next;
+    uint32_t depth;      // begins written and still open, each one has room held for its end
+    uint32_t skip_depth; // begins dropped and still open, their ends get dropped too
+    uint32_t off_depth;  // begins made while disabled (or inside one that was) and still open, their ends don't get written either
+    uint64_t drops;      // dropped since the last marker
+    double drop_when;
+    uint32_t drop_pid;
+    uint32_t drop_tid;
+    // the front of a begin (type, category, pid, tid) and an end (type, pid, tid) for the last pid/tid we wrote,
+    // so writing one is a 16 byte copy and a couple of patches instead of a store per field.
+    // has_template keeps a zeroed buffer (all-zero templates, key 0) from passing for pid 0/tid 0.
+    uint64_t template_key;
+    bool has_template;
+    uint8_t begin_template[16];
+    uint8_t end_template[16];
+#if defined(SPALL_PERCPU)
+    uint32_t cpu; // where our last event went, UINT32_MAX before the first one
+#endif
+};
+
+// One of these per call site (or per name, indexed by your own name IDs), per thread:
+//     static _Thread_local SpallSampler sampler = { .rate = 64 };
+// Deciding is just a countdown, the first instance is kept, then every rate'th one after that.
+typedef struct SpallSampler {
+    uint32_t rate; // keep 1 in rate, 0 and 1 keep everything
+
+    // Internal data - don't assign this
+    uint32_t countdown;
+} SpallSampler;
+
+// A pile of events in SoA form, for converters and replay tools that have them all up front.
+// Begins and instants name themselves with an index into names/name_lengths, ends ignore theirs.
+typedef struct SpallBatch {
+    size_t count;
+    const uint8_t  *types; // SpallEventType_Begin, _End, or _Instant
+    const uint32_t *name_ids;
+    const double   *whens;
+    const uint32_t *tids;
+    uint32_t pid;
+
+    const char *const *names;
+    const uint8_t *name_lengths;
+} SpallBatch;
 
 #ifdef __cplusplus
 extern "C" {
@@ -125,6 +476,7 @@ extern "C" {
 #endif
 
 SPALL_FN SPALL_FORCEINLINE void spall__buffer_profile(SpallProfile *ctx, SpallBuffer *wb, double spall_time_begin, double spall_time_end, const char *name, int name_len);
+SPALL_FN void spall__buffer_drop_marker(SpallProfile *ctx, SpallBuffer *wb);
 #ifdef SPALL_BUFFER_PROFILING
 #define SPALL_BUFFER_PROFILE_BEGIN() double spall_time_begin = (SPALL_BUFFER_PROFILING_GET_TIME())
 // Don't call this with anything other than a string literal
@@ -134,6 +486,56 @@ SPALL_FN SPALL_FORCEINLINE void spall__buffer_profile(SpallProfile *ctx, SpallBu
 #define SPALL_BUFFER_PROFILE_END(name)
 #endif
 
+// Flush timing for SpallStats, in microseconds. Only read around writes, never per event.
+#ifndef SPALL_STATS_GET_TIME
+#if !defined(_WIN32)
+SPALL_FN double spall__stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+#else
+SPALL_FN double spall__stats_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+#endif
+#define SPALL_STATS_GET_TIME() spall__stats_now()
+#endif
+
+// only guards the buffer list, which changes once per thread (or so), so spinning is fine
+#if defined(_MSC_VER) && !defined(__clang__)
+SPALL_FN void spall__lock(volatile long *lock) { while (_InterlockedExchange(lock, 1)) {} }
+SPALL_FN void spall__unlock(volatile long *lock) { _InterlockedExchange(lock, 0); }
+#else
+SPALL_FN void spall__lock(volatile long *lock) { while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {} }
+SPALL_FN void spall__unlock(volatile long *lock) { __atomic_store_n(lock, 0, __ATOMIC_RELEASE); }
+#endif
+
+SPALL_FN void spall__stats_add(SpallStats *dst, const SpallStats *src) {
+    dst->events += src->events;
+    dst->bytes += src->bytes;
+    dst->flushes += src->flushes;
+    dst->flush_us += src->flush_us;
+    dst->max_flush_us = src->max_flush_us > dst->max_flush_us ? src->max_flush_us : dst->max_flush_us;
+    dst->dropped += src->dropped;
+    dst->truncated += src->truncated;
+}
+
+SPALL_FN SPALL_FORCEINLINE void spall__stats_flush(SpallStats *stats, size_t bytes, double time_begin, double time_end) {
+    double flush_us = time_end - time_begin;
+    stats->bytes += bytes;
+    stats->flushes += 1;
+    stats->flush_us += flush_us;
+    stats->max_flush_us = flush_us > stats->max_flush_us ? flush_us : stats->max_flush_us;
+}
+
+SPALL_FN SPALL_FORCEINLINE void spall__stats_event(SpallStats *stats, signed long name_len, signed long args_len) {
+    stats->events += 1;
+    stats->truncated += (name_len > 255 || args_len > 255);
+}
+
 SPALL_FN SPALL_FORCEINLINE bool spall__file_write(SpallProfile *ctx, const void *p, size_t n) {
     if (!ctx->data) return false;
 #ifdef SPALL_DEBUG
@@ -166,6 +568,75 @@ SPALL_FN void spall__file_close(SpallProfile *ctx) {
     ctx->data = NULL;
 }
 
+static const uint32_t spall__crc32c_table[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C, 0x26A1E7E8, 0xD4CA64EB,
+    0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B, 0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24,
+    0x105EC76F, 0xE235446C, 0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC, 0xBC267848, 0x4E4DFB4B,
+    0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A, 0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35,
+    0xAA64D611, 0x580F5512, 0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD, 0x1642AE59, 0xE4292D5A,
+    0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A, 0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595,
+    0x417B1DBC, 0xB3109EBF, 0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F, 0xED03A29B, 0x1F682198,
+    0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927, 0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38,
+    0xDBFC821C, 0x2997011F, 0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E, 0x4767748A, 0xB50CF789,
+    0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859, 0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46,
+    0x7198540D, 0x83F3D70E, 0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE, 0xDDE0EB2A, 0x2F8B6829,
+    0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C, 0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93,
+    0x082F63B7, 0xFA44E0B4, 0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B, 0xB4091BFF, 0x466298FC,
+    0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C, 0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033,
+    0xA24BB5A6, 0x502036A5, 0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975, 0x0E330A81, 0xFC588982,
+    0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D, 0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622,
+    0x38CC2A06, 0xCAA7A905, 0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8, 0xE52CC12C, 0x1747422F,
+    0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF, 0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0,
+    0xD3D3E1AB, 0x21B862A8, 0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78, 0x7FAB5E8C, 0x8DC0DD8F,
+    0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE, 0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1,
+    0x69E9F0D5, 0x9B8273D6, 0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
+    0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351,
+};
+
+// CRC32C (Castagnoli), chain calls by passing in the previous result
+SPALL_FN uint32_t spall_crc32c(uint32_t crc, const void *data, size_t length) {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+#if defined(SPALL_CRC32C_X64)
+    for (; length >= 8; length -= 8, p += 8) {
+        uint64_t v; memcpy(&v, p, sizeof(v));
+        crc = (uint32_t)_mm_crc32_u64(crc, v);
+    }
+#elif defined(SPALL_CRC32C_ARM)
+    for (; length >= 8; length -= 8, p += 8) {
+        uint64_t v; memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+    }
+#endif
+    for (; length; length--, p++) {
+        crc = spall__crc32c_table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall__buffer_has_blocks(SpallProfile *ctx, SpallBuffer *wb) {
+    return wb->tag_blocks && ctx && !ctx->is_json;
+}
+
+// leave room for the next block's header up front, it gets filled in on flush
+SPALL_FN SPALL_FORCEINLINE void spall__buffer_start_block(SpallProfile *ctx, SpallBuffer *wb) {
+    if (spall__buffer_has_blocks(ctx, wb)) {
+        wb->head = sizeof(SpallBlockHeader);
+        wb->block_min_when = INFINITY;
+        wb->block_max_when = -INFINITY;
+    }
+}
+
 SPALL_FN SPALL_FORCEINLINE bool spall__buffer_flush(SpallProfile *ctx, SpallBuffer *wb) {
     // precon: wb
     // precon: wb->data
@@ -175,20 +646,259 @@ SPALL_FN SPALL_FORCEINLINE bool spall__buffer_flush(SpallProfile *ctx, SpallBuff
     if (wb->ctx != ctx) return false; // Buffer must be bound to this context (or to NULL)
 #endif
 
+    if (spall__buffer_has_blocks(ctx, wb)) {
+        if (wb->head <= sizeof(SpallBlockHeader)) {
+            wb->head = 0; // nothing in the block, don't bother writing it
+        } else {
+            SpallBlockHeader *block = (SpallBlockHeader *)wb->data;
+            block->type = SpallEventType_Block;
+            block->magic = SPALL_BLOCK_MAGIC;
+            block->pid = wb->pid;
+            block->tid = wb->tid;
+            block->length = (uint32_t)(wb->head - sizeof(SpallBlockHeader));
+            block->min_when = wb->block_min_when;
+            block->max_when = wb->block_max_when;
+            block->crc = 0;
+            block->crc = spall_crc32c(0, wb->data, wb->head);
+        }
+    }
+
     if (wb->head && ctx) {
         SPALL_BUFFER_PROFILE_BEGIN();
+        double stats_begin = SPALL_STATS_GET_TIME();
         if (!ctx->write) return false;
         if (ctx->write == spall__file_write) {
             if (!spall__file_write(ctx, wb->data, wb->head)) return false;
         } else {
             if (!ctx->write(ctx, wb->data, wb->head)) return false;
         }
+        spall__stats_flush(&wb->stats, wb->head, stats_begin, SPALL_STATS_GET_TIME());
         SPALL_BUFFER_PROFILE_END("Buffer Flush");
     }
     wb->head = 0;
+    spall__buffer_start_block(ctx, wb);
+    if (wb->drops && ctx) spall__buffer_drop_marker(ctx, wb);
+    return true;
+}
+
+#if defined(SPALL_PERCPU)
+// Per-cpu buffers: with far more threads than cores (ie: thread pools), per-thread buffers are mostly
+// sitting around half-empty. Here, each thread only stages one event at a time, and hands it to a
+// buffer owned by the cpu it's running on, with a restartable sequence (rseq) instead of a lock.
+// Every event already carries its pid/tid, so the viewer sorts them back out by thread.
+// A drain thread writes out each cpu's buffer every drain_ms, and so does a writer that finds its cpu's full.
+// Each cpu's buffer comes in two halves, so a flush swaps in the empty half and writes the full one.
+// Needs glibc 2.35+ (it registers rseq for every thread), and Linux 5.10+ for membarrier's rseq fence.
+#define SPALL_CPU_STAGING_SIZE 1024 // fits any one event, 255 byte name and args included
+#define SPALL_CPU_DEFAULT_SIZE (1024 * 1024)
+#define SPALL_CPU_DRAIN_MS 50
+
+// spall__cpu_commit knows where data, length, and head are, keep them first and in this order
+typedef struct SpallCpuBuffer {
+    char *data;
+    size_t length;
+    size_t head;
+    uint8_t pad[40]; // each head gets its own cache line, so neighboring cpus don't fight over them
+} SpallCpuBuffer;
+
+struct SpallCpuBuffers {
+    SpallProfile *ctx;
+    int cpu_count;
+    SpallCpuBuffer **current; // the half each cpu's writers are filling
+    SpallCpuBuffer *halves;   // two per cpu
+    char *memory;
+    size_t memory_size;
+
+    pthread_mutex_t flush_lock;
+    pthread_t drain;
+    unsigned drain_ms;
+    volatile bool draining;
+};
+
+// Copies len bytes past the head of this cpu's buffer, then bumps the head. That last store is the commit:
+// if we get preempted, migrated, or signaled before it, the kernel sends us back to the top, so a half-written
+// event is never visible, and nobody else on the cpu can be in here at the same time.
+// Returns 0 once it's in, 1 if this cpu's buffer is full, and 2 if we're not on expected_cpu, with *cpu_out set either way.
+SPALL_FN int spall__cpu_commit(SpallCpuBuffer **current, const void *src, size_t len, uint32_t expected_cpu, uint32_t *cpu_out) {
+    struct rseq *rs = (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+    uint64_t cpu;
+    int status;
+    __asm__ __volatile__(
+        ".pushsection __rseq_cs, \"aw\"\n"
+        ".balign 32\n"
+        "3:\n"
+        ".long 0, 0\n"               // version, flags
+        ".quad 1f, 2f - 1f, 4f\n"    // start, length, abort
+        ".popsection\n"
+        "5:\n"
+        "leaq 3b(%%rip), %%rax\n"
+        "movq %%rax, 8(%[rs])\n"     // rs->rseq_cs
+        "1:\n"
+        "movl 4(%[rs]), %k[cpu]\n"   // rs->cpu_id
+        "cmpl %k[cpu], %k[expected]\n"
+        "jne 6f\n"
+        "movq (%[current], %[cpu], 8), %%rax\n"
+        "movq 16(%%rax), %%r9\n"
+        "movq (%%rax), %%rdi\n"
+        "addq %%r9, %%rdi\n"
+        "addq %[len], %%r9\n"
+        "cmpq 8(%%rax), %%r9\n"
+        "ja 7f\n"
+        "movq %[src], %%rsi\n"
+        "movq %[len], %%rcx\n"
+        "rep movsb\n"
+        "movq %%r9, 16(%%rax)\n"
+        "2:\n"
+        "xorl %k[status], %k[status]\n"
+        "jmp 8f\n"
+        ".byte 0x0f, 0xb9, 0x3d\n"   // ud1, so the signature below can't be run by accident
+        ".long 0x53053053\n"         // RSEQ_SIG, the kernel won't jump to an abort handler without it
+        "4:\n"
+        "jmp 5b\n"
+        "6:\n"
+        "movl $2, %k[status]\n"
+        "jmp 8f\n"
+        "7:\n"
+        "movl $1, %k[status]\n"
+        "8:\n"
+        : [cpu] "=&r"(cpu), [status] "=&r"(status)
+        : [rs] "r"(rs), [current] "r"(current), [src] "r"(src), [len] "r"(len), [expected] "r"(expected_cpu)
+        : "rax", "r9", "rdi", "rsi", "rcx", "memory", "cc");
+    *cpu_out = (uint32_t)cpu;
+    return status;
+}
+
+SPALL_FN bool spall__cpu_flush(SpallCpuBuffers *cpus, uint32_t cpu) {
+    pthread_mutex_lock(&cpus->flush_lock);
+
+    bool ok = true;
+    SpallCpuBuffer *full = cpus->current[cpu];
+    if (full->head) {
+        SpallCpuBuffer *empty = &cpus->halves[cpu * 2 + (full == &cpus->halves[cpu * 2])];
+        __atomic_store_n(&cpus->current[cpu], empty, __ATOMIC_RELEASE);
+
+        // restarts anyone still partway through a commit on that cpu, so they land in the empty half
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ, MEMBARRIER_CMD_FLAG_CPU, (int)cpu);
+
+        ok = cpus->ctx->write(cpus->ctx, full->data, full->head);
+        full->head = 0;
+    }
+
+    pthread_mutex_unlock(&cpus->flush_lock);
+    return ok;
+}
+
+// Every binary event ends up in spall__buffer_track, so that's where it leaves the staging buffer
+SPALL_FN void spall__cpu_commit_staged(SpallBuffer *wb) {
+    SpallCpuBuffers *cpus = wb->cpus;
+    for (;;) {
+        uint32_t cpu;
+        int status = spall__cpu_commit(cpus->current, wb->data, wb->head, wb->cpu, &cpu);
+        if (status == 0) break;
+
+        if (status == 1) {
+            if (wb->head > cpus->halves[0].length || !spall__cpu_flush(cpus, cpu)) {
+                wb->stats.dropped += 1;
+                break;
+            }
+        } else {
+            // write out what we left on the old cpu first, so each thread's events still come out in order
+            if (wb->cpu != UINT32_MAX) spall__cpu_flush(cpus, wb->cpu);
+            wb->cpu = cpu;
+        }
+    }
+    wb->head = 0;
+}
+
+SPALL_FN bool spall_cpu_buffers_flush(SpallCpuBuffers *cpus) {
+    bool ok = true;
+    for (int cpu = 0; cpu < cpus->cpu_count; cpu++) {
+        ok &= spall__cpu_flush(cpus, (uint32_t)cpu);
+    }
+    return ok;
+}
+
+SPALL_FN void *spall__cpu_drain(void *arg) {
+    SpallCpuBuffers *cpus = (SpallCpuBuffers *)arg;
+    while (cpus->draining) {
+        struct timespec ts = { (time_t)(cpus->drain_ms / 1000), (long)(cpus->drain_ms % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+        spall_cpu_buffers_flush(cpus);
+    }
+    return NULL;
+}
+
+// size is per half, and every cpu gets two, but pages nobody writes to never get touched.
+// drain_ms = 0 skips the drain thread, and leaves it to you (and full buffers) to call spall_cpu_buffers_flush.
+// Binary only, and fails if rseq or membarrier's rseq fence aren't there.
+SPALL_FN bool spall_cpu_buffers_init(SpallProfile *ctx, SpallCpuBuffers *cpus, size_t size, unsigned drain_ms) {
+    memset(cpus, 0, sizeof(*cpus));
+    if (!ctx || ctx->is_json || !ctx->write) return false;
+    if (__rseq_size == 0) return false; // glibc didn't register rseq (too old, or turned off with GLIBC_TUNABLES)
+    if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) != 0) return false;
+
+    cpus->ctx = ctx;
+    cpus->cpu_count = get_nprocs_conf();
+    cpus->current = (SpallCpuBuffer **)calloc((size_t)cpus->cpu_count, sizeof(SpallCpuBuffer *));
+    cpus->halves = (SpallCpuBuffer *)calloc((size_t)cpus->cpu_count * 2, sizeof(SpallCpuBuffer));
+    cpus->memory_size = size * 2 * (size_t)cpus->cpu_count;
+    cpus->memory = (char *)mmap(NULL, cpus->memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (!cpus->current || !cpus->halves || cpus->memory == MAP_FAILED) {
+        free(cpus->current);
+        free(cpus->halves);
+        if (cpus->memory != MAP_FAILED) munmap(cpus->memory, cpus->memory_size);
+        memset(cpus, 0, sizeof(*cpus));
+        return false;
+    }
+
+    for (int i = 0; i < cpus->cpu_count * 2; i++) {
+        cpus->halves[i].data = cpus->memory + (size_t)i * size;
+        cpus->halves[i].length = size;
+    }
+    for (int cpu = 0; cpu < cpus->cpu_count; cpu++) {
+        cpus->current[cpu] = &cpus->halves[cpu * 2];
+    }
+    pthread_mutex_init(&cpus->flush_lock, NULL);
+
+    cpus->drain_ms = drain_ms;
+    if (drain_ms) {
+        cpus->draining = true;
+        if (pthread_create(&cpus->drain, NULL, spall__cpu_drain, cpus) != 0) {
+            cpus->draining = false;
+            cpus->drain_ms = 0;
+        }
+    }
     return true;
 }
 
+// Call once every buffer pointing at cpus has been spall_buffer_quit, and before spall_quit
+SPALL_FN bool spall_cpu_buffers_quit(SpallCpuBuffers *cpus) {
+    if (!cpus->ctx) return false;
+    if (cpus->drain_ms) {
+        cpus->draining = false;
+        pthread_join(cpus->drain, NULL);
+    }
+
+    bool ok = spall_cpu_buffers_flush(cpus);
+    pthread_mutex_destroy(&cpus->flush_lock);
+    munmap(cpus->memory, cpus->memory_size);
+    free(cpus->current);
+    free(cpus->halves);
+    memset(cpus, 0, sizeof(*cpus));
+    return ok;
+}
+#endif
+
+SPALL_FN SPALL_FORCEINLINE void spall__buffer_track(SpallBuffer *wb, double when_begin, double when_end) {
+    if (wb->tag_blocks) {
+        wb->block_min_when = when_begin < wb->block_min_when ? when_begin : wb->block_min_when;
+        wb->block_max_when = when_end   > wb->block_max_when ? when_end   : wb->block_max_when;
+    }
+#if defined(SPALL_PERCPU)
+    if (wb->cpus) spall__cpu_commit_staged(wb);
+#endif
+}
+
 SPALL_FN SPALL_FORCEINLINE bool spall__buffer_write(SpallProfile *ctx, SpallBuffer *wb, void *p, size_t n) {
     // precon: !wb || wb->head < wb->length
     // precon: !ctx || ctx->write
@@ -199,7 +909,9 @@ SPALL_FN SPALL_FORCEINLINE bool spall__buffer_write(SpallProfile *ctx, SpallBuff
     if (wb->head + n > wb->length && !spall__buffer_flush(ctx, wb)) return false;
     if (n > wb->length) {
         SPALL_BUFFER_PROFILE_BEGIN();
+        double stats_begin = SPALL_STATS_GET_TIME();
         if (!ctx->write || !ctx->write(ctx, p, n)) return false;
+        spall__stats_flush(&wb->stats, n, stats_begin, SPALL_STATS_GET_TIME());
         SPALL_BUFFER_PROFILE_END("Unbuffered Write");
         return true;
     }
@@ -208,6 +920,202 @@ SPALL_FN SPALL_FORCEINLINE bool spall__buffer_write(SpallProfile *ctx, SpallBuff
     return true;
 }
 
+SPALL_FN SPALL_FORCEINLINE void spall__buffer_drop(SpallBuffer *wb, uint64_t count, double when, uint32_t tid, uint32_t pid) {
+    wb->stats.dropped += count;
+    wb->drops += count;
+    wb->drop_when = when;
+    wb->drop_tid = tid;
+    wb->drop_pid = pid;
+}
+
+// Sizes one event we know how to write, or returns 0 if it's something else (or cut off)
+SPALL_FN size_t spall__event_size(const uint8_t *ev, size_t rem_size) {
+    size_t size = 0;
+    size_t strings = 0;
+    switch (ev[0] & 0x7F) {
+    case SpallEventType_Begin:          size = sizeof(SpallBeginEvent);         strings = offsetof(SpallBeginEvent, name_length);         break;
+    case SpallEventType_Instant:        size = sizeof(SpallInstantEvent);       strings = offsetof(SpallInstantEvent, name_length);       break;
+    case SpallEventType_Complete:       size = sizeof(SpallCompleteEvent);      strings = offsetof(SpallCompleteEvent, name_length);      break;
+    case SpallEventType_Depth_Begin:    size = sizeof(SpallDepthBeginEvent);    strings = offsetof(SpallDepthBeginEvent, name_length);    break;
+    case SpallEventType_Depth_Complete: size = sizeof(SpallDepthCompleteEvent); strings = offsetof(SpallDepthCompleteEvent, name_length); break;
+    case SpallEventType_Sampled_Begin:  size = sizeof(SpallSampledBeginEvent);  strings = offsetof(SpallSampledBeginEvent, name_length);  break;
+    case SpallEventType_End:            size = sizeof(SpallEndEvent);       break;
+    case SpallEventType_Clock_Sync:     size = sizeof(SpallClockSyncEvent); break;
+    case SpallEventType_Alloc:
+    case SpallEventType_Free:           size = sizeof(SpallAllocEvent);     break;
+    case SpallEventType_Fiber_Switch:   size = sizeof(SpallFiberSwitchEvent); break;
+    case SpallEventType_Name_Process:   if (rem_size >= sizeof(SpallNameProcessEvent)) size = sizeof(SpallNameProcessEvent) + ev[offsetof(SpallNameProcessEvent, name_length)]; break;
+    case SpallEventType_Name_Thread:    if (rem_size >= sizeof(SpallNameThreadEvent))  size = sizeof(SpallNameThreadEvent)  + ev[offsetof(SpallNameThreadEvent, name_length)];  break;
+    default: return 0;
+    }
+
+    // name and args lengths always sit back to back
+    if (strings && rem_size >= size) size += ev[strings] + ev[strings + 1];
+    return size <= rem_size ? size : 0;
+}
+
+#define SPALL_COMPACT_MAX_DEPTH 256
+#define SPALL_COMPACT_MAX_PAIRS 512 // past that, the rest of the pairs stay for this round
+
+// Drop_Oldest: throws out the begin/end pairs that both landed in the buffer, and the completes.
+// Begins that are still open, ends for begins that already went out, and instants/metadata stay,
+// so the trace still pairs up. Returns how many events went.
+SPALL_FN uint64_t spall__buffer_compact(SpallBuffer *wb) {
+    uint8_t *data = (uint8_t *)wb->data;
+    size_t start = wb->tag_blocks ? sizeof(SpallBlockHeader) : 0;
+
+    // find the pairs first, and only mark them once we know we can go through with it,
+    // so bailing out never leaves a type byte with its high bit set for the next flush to write out
+    uint32_t open[SPALL_COMPACT_MAX_DEPTH];
+    uint32_t open_count = 0;
+    uint32_t pairs[SPALL_COMPACT_MAX_PAIRS][2];
+    uint32_t pair_count = 0;
+    for (size_t pos = start; pos < wb->head; ) {
+        size_t ev_size = spall__event_size(data + pos, wb->head - pos);
+        if (!ev_size) return 0;
+
+        uint8_t type = data[pos];
+        if (type == SpallEventType_Fiber_Switch) {
+            open_count = 0; // fibers don't nest, so a begin before the switch isn't the parent of anything after it
+        } else if (type == SpallEventType_Begin || type == SpallEventType_Depth_Begin || type == SpallEventType_Sampled_Begin) {
+            if (open_count == SPALL_COMPACT_MAX_DEPTH) return 0; // too deep to bother, drop newest instead
+            open[open_count++] = (uint32_t)pos;
+        } else if (type == SpallEventType_End && open_count) {
+            open_count -= 1;
+            if (pair_count < SPALL_COMPACT_MAX_PAIRS) {
+                pairs[pair_count][0] = open[open_count];
+                pairs[pair_count][1] = (uint32_t)pos;
+                pair_count += 1;
+            }
+        }
+        pos += ev_size;
+    }
+
+    // mark the pairs by setting the type's high bit, so the second pass knows to skip them
+    for (uint32_t i = 0; i < pair_count; i++) {
+        data[pairs[i][0]] |= 0x80;
+        data[pairs[i][1]] |= 0x80;
+    }
+
+    uint64_t removed = 0;
+    size_t out = start;
+    for (size_t pos = start; pos < wb->head; ) {
+        size_t ev_size = spall__event_size(data + pos, wb->head - pos);
+        uint8_t type = data[pos];
+        if ((type & 0x80) || type == SpallEventType_Complete || type == SpallEventType_Depth_Complete) {
+            removed += 1;
+        } else {
+            memmove(data + out, data + pos, ev_size);
+            out += ev_size;
+        }
+        pos += ev_size;
+    }
+
+    wb->head = out;
+    return removed;
+}
+
+// Gets room for size bytes, after the fast check in spall__buffer_reserve fails
+SPALL_FN bool spall__buffer_make_room(SpallProfile *ctx, SpallBuffer *wb, size_t need, double when, uint32_t tid, uint32_t pid) {
+    if (spall__buffer_flush(ctx, wb)) return wb->head + need <= wb->length;
+
+    if (ctx->backpressure == SpallBackpressure_Drop_Oldest && !ctx->is_json) {
+        uint64_t removed = spall__buffer_compact(wb);
+        if (removed) spall__buffer_drop(wb, removed, when, tid, pid);
+        return wb->head + need <= wb->length;
+    }
+    return false;
+}
+
+#define SPALL__JSON_END_MAX 128 // {"ph":"E",...} with a long timestamp and pid/tid, and then some
+
+// Under the drop policies, every open begin holds room for its end, so ends never have to wait
+// on the sink, and a begin that made it out always gets closed.
+SPALL_FN SPALL_FORCEINLINE bool spall__buffer_reserve(SpallProfile *ctx, SpallBuffer *wb, size_t size, uint32_t open_ends, double when, uint32_t tid, uint32_t pid) {
+    size_t need = size;
+#if defined(SPALL_PERCPU)
+    // staging buffers empty out after every event, so there's nothing to hold room in
+    if (wb->cpus) open_ends = 0;
+#endif
+    if (ctx->backpressure != SpallBackpressure_Block) need += open_ends * (ctx->is_json ? SPALL__JSON_END_MAX : sizeof(SpallEndEvent));
+    if (wb->head + need <= wb->length) return true;
+    return spall__buffer_make_room(ctx, wb, need, when, tid, pid);
+}
+
+// Room a flush can't hand back: the next block's header, and a drop marker if we've lost anything
+#define SPALL__FLUSH_SLACK (sizeof(SpallBlockHeader) + sizeof(SpallInstantEvent) + 64)
+
+// Only for records that wouldn't fit in an empty buffer, args go first, then the name
+static SPALL_NOINSTRUMENT SPALL_NOINLINE void spall__record_trim(SpallBuffer *wb, size_t fixed, signed long *name_len, signed long *args_len) {
+    size_t room = wb->length > fixed + SPALL__FLUSH_SLACK ? wb->length - (fixed + SPALL__FLUSH_SLACK) : 0;
+    size_t name = SPALL_MIN((size_t)SPALL_MIN(*name_len, 255), room);
+    size_t args = SPALL_MIN((size_t)SPALL_MIN(*args_len, 255), room - name);
+    *name_len = (signed long)name;
+    *args_len = (signed long)args;
+    wb->stats.truncated += 1; // the lengths are under 255 now, so spall__stats_event won't see it
+}
+
+// What a record with these strings really takes up, so small buffers aren't stuck reserving 500+ bytes of
+// strings that aren't there.
+SPALL_FN SPALL_FORCEINLINE size_t spall__record_size(size_t fixed, signed long name_len, signed long args_len) {
+    return fixed + (size_t)SPALL_MIN(name_len, 255) + (size_t)SPALL_MIN(args_len, 255);
+}
+
+// Anything bigger than the whole buffer goes through a spall__*_trimmed instead, so under
+// SpallBackpressure_Block, a flush that goes through always leaves room for the next event.
+// Those are out of line and call back in with trimmed lengths, so the lengths (and the copies
+// they size) stay compile-time constants here whenever the caller's are.
+SPALL_FN SPALL_FORCEINLINE bool spall__record_fits(SpallBuffer *wb, size_t size) {
+    return size + SPALL__FLUSH_SLACK <= wb->length;
+}
+
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__begin_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid);
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__complete_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint32_t tid, uint32_t pid);
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__begin_depth_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint16_t depth, uint32_t tid, uint32_t pid);
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__complete_depth_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint16_t depth, uint32_t tid, uint32_t pid);
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__begin_sampled_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t sample_rate, uint32_t tid, uint32_t pid);
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__instant_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid);
+
+// A begin that doesn't get written takes everything up to (and including) its end with it
+SPALL_FN SPALL_FORCEINLINE void spall__buffer_skip_begin(SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+    wb->skip_depth += 1;
+    spall__buffer_drop(wb, 1, when, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall__buffer_begin_room(SpallProfile *ctx, SpallBuffer *wb, size_t size, double when, uint32_t tid, uint32_t pid) {
+    if (!wb->skip_depth && spall__buffer_reserve(ctx, wb, size, wb->depth + 1, when, tid, pid)) {
+        wb->depth += 1;
+        return true;
+    }
+    spall__buffer_skip_begin(wb, when, tid, pid);
+    return false;
+}
+
+// Returns true if this end's begin got dropped, so it has to go too
+SPALL_FN SPALL_FORCEINLINE bool spall__buffer_skip_end(SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+    if (!wb->skip_depth) {
+        if (wb->depth) wb->depth -= 1;
+        return false;
+    }
+
+    wb->skip_depth -= 1;
+    spall__buffer_drop(wb, 1, when, tid, pid);
+    return true;
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall__buffer_end_room(SpallProfile *ctx, SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+    if (spall__buffer_skip_end(wb, when, tid, pid)) return false;
+    if (spall__buffer_reserve(ctx, wb, ctx->is_json ? SPALL__JSON_END_MAX : sizeof(SpallEndEvent), wb->depth, when, tid, pid)) return true;
+    spall__buffer_drop(wb, 1, when, tid, pid);
+    return false;
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall__buffer_room(SpallProfile *ctx, SpallBuffer *wb, size_t size, double when, uint32_t tid, uint32_t pid) {
+    if (spall__buffer_reserve(ctx, wb, size, wb->depth, when, tid, pid)) return true;
+    spall__buffer_drop(wb, 1, when, tid, pid);
+    return false;
+}
+
 SPALL_FN bool spall_buffer_flush(SpallProfile *ctx, SpallBuffer *wb) {
 #ifdef SPALL_DEBUG
     if (!wb) return false;
@@ -218,27 +1126,106 @@ SPALL_FN bool spall_buffer_flush(SpallProfile *ctx, SpallBuffer *wb) {
     return true;
 }
 
+SPALL_FN void spall__buffer_register(SpallProfile *ctx, SpallBuffer *wb) {
+    memset(&wb->stats, 0, sizeof(wb->stats));
+    wb->depth = 0;
+    wb->skip_depth = 0;
+    wb->off_depth = 0;
+    wb->drops = 0;
+    if (!ctx) return;
+
+    spall__lock(&ctx->buffers_lock);
+    wb->next = ctx->buffers;
+    ctx->buffers = wb;
+    spall__unlock(&ctx->buffers_lock);
+}
+
+// hands the buffer's stats over to the profile, so they outlive it
+SPALL_FN void spall__buffer_unregister(SpallProfile *ctx, SpallBuffer *wb) {
+    if (!ctx) return;
+
+    spall__lock(&ctx->buffers_lock);
+    for (SpallBuffer **it = &ctx->buffers; *it; it = &(*it)->next) {
+        if (*it == wb) {
+            *it = wb->next;
+            spall__stats_add(&ctx->retired, &wb->stats);
+            break;
+        }
+    }
+    spall__unlock(&ctx->buffers_lock);
+    wb->next = NULL;
+}
+
+SPALL_FN void spall__buffer_template(SpallBuffer *wb, uint32_t tid, uint32_t pid) {
+    SpallBeginEvent begin = { SpallEventType_Begin, 0, pid, tid, 0, 0, 0 };
+    SpallEndEvent end = { SpallEventType_End, pid, tid, 0 };
+    memcpy(wb->begin_template, &begin, sizeof(wb->begin_template));
+    memcpy(wb->end_template, &end, sizeof(wb->end_template));
+    wb->template_key = ((uint64_t)tid << 32) | pid;
+    wb->has_template = true;
+}
+
 SPALL_FN bool spall_buffer_init(SpallProfile *ctx, SpallBuffer *wb) {
     if (!spall_buffer_flush(NULL, wb)) return false;
+    if (wb->tag_blocks && wb->length > SPALL_MAX_BLOCK_SIZE + sizeof(SpallBlockHeader)) {
+        wb->length = SPALL_MAX_BLOCK_SIZE + sizeof(SpallBlockHeader);
+    }
     wb->ctx = ctx;
+#if defined(SPALL_PERCPU)
+    wb->cpu = UINT32_MAX;
+#endif
+    spall__buffer_template(wb, wb->tid, wb->pid);
+    spall__buffer_register(ctx, wb);
+    spall__buffer_start_block(ctx, wb);
     return true;
 }
 SPALL_FN bool spall_buffer_quit(SpallProfile *ctx, SpallBuffer *wb) {
     if (!spall_buffer_flush(ctx, wb)) return false;
+    if (wb->head && !spall_buffer_flush(ctx, wb)) return false; // the drop marker that flush left behind
+    spall__buffer_unregister(ctx, wb);
     wb->ctx = NULL;
     return true;
 }
 
 SPALL_FN bool spall_buffer_abort(SpallBuffer *wb) {
     if (!wb) return false;
+    spall__buffer_unregister(wb->ctx, wb);
     wb->ctx = NULL;
     if (!spall__buffer_flush(NULL, wb)) return false;
     return true;
 }
 
-SPALL_FN size_t spall_build_header(void *buffer, size_t rem_size, double timestamp_unit) {
-    size_t header_size = sizeof(SpallHeader);
-    if (header_size > rem_size) {
+// Adds up every buffer's stats. Buffers still being written to are read without a lock,
+// so their numbers can be a few events behind, but never torn on 64-bit targets.
+SPALL_FN SpallStats spall_get_stats(SpallProfile *ctx) {
+    SpallStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (!ctx) return stats;
+
+    spall__lock(&ctx->buffers_lock);
+    stats = ctx->retired;
+    for (SpallBuffer *wb = ctx->buffers; wb; wb = wb->next) {
+        spall__stats_add(&stats, &wb->stats);
+    }
+    spall__unlock(&ctx->buffers_lock);
+    return stats;
+}
+
+SPALL_FN SpallStats spall_buffer_get_stats(SpallBuffer *wb) {
+    return wb->stats;
+}
+
+// Hands the current totals to ctx->on_stats, ie: once a second, to check tracing against a budget
+SPALL_FN void spall_report_stats(SpallProfile *ctx) {
+    if (!ctx || !ctx->on_stats) return;
+
+    SpallStats stats = spall_get_stats(ctx);
+    ctx->on_stats(ctx, &stats);
+}
+
+SPALL_FN size_t spall_build_header(void *buffer, size_t rem_size, double timestamp_unit) {
+    size_t header_size = sizeof(SpallHeader);
+    if (header_size > rem_size) {
         return 0;
     }
 
@@ -267,7 +1254,7 @@ SPALL_FN SPALL_FORCEINLINE size_t spall_build_begin(void *buffer, size_t rem_siz
     ev->event.name_length = trunc_name_len;
     ev->event.args_length = trunc_args_len;
     memcpy(ev->name_bytes,            name, trunc_name_len);
-    memcpy(ev->name_bytes + name_len, args, trunc_args_len);
+    memcpy(ev->name_bytes + trunc_name_len, args, trunc_args_len);
 
     return ev_size;
 }
@@ -286,8 +1273,234 @@ SPALL_FN SPALL_FORCEINLINE size_t spall_build_end(void *buffer, size_t rem_size,
     return ev_size;
 }
 
+// Same bytes as spall_build_begin/spall_build_end, for callers that already made room in wb
+SPALL_FN SPALL_FORCEINLINE size_t spall__buffer_build_begin(SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
+    if ((((uint64_t)tid << 32) | pid) != wb->template_key || !wb->has_template) spall__buffer_template(wb, tid, pid);
+
+    uint8_t lengths[2] = { (uint8_t)SPALL_MIN(name_len, 255), (uint8_t)SPALL_MIN(args_len, 255) };
+    char *ev = (char *)wb->data + wb->head;
+    memcpy(ev, wb->begin_template, sizeof(wb->begin_template));
+    memcpy(ev + offsetof(SpallBeginEvent, when), &when, sizeof(when));
+    memcpy(ev + offsetof(SpallBeginEvent, name_length), lengths, sizeof(lengths));
+    memcpy(ev + sizeof(SpallBeginEvent), name, lengths[0]);
+    memcpy(ev + sizeof(SpallBeginEvent) + lengths[0], args, lengths[1]);
+    return sizeof(SpallBeginEvent) + lengths[0] + lengths[1];
+}
+SPALL_FN SPALL_FORCEINLINE size_t spall__buffer_build_end(SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+    if ((((uint64_t)tid << 32) | pid) != wb->template_key || !wb->has_template) spall__buffer_template(wb, tid, pid);
+
+    char *ev = (char *)wb->data + wb->head;
+    memcpy(ev, wb->end_template, sizeof(wb->end_template));
+    memcpy(ev + offsetof(SpallEndEvent, when), &when, sizeof(when));
+    return sizeof(SpallEndEvent);
+}
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_instant(void *buffer, size_t rem_size, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
+    SpallInstantEventMax *ev = (SpallInstantEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255);
+    uint8_t trunc_args_len = (uint8_t)SPALL_MIN(args_len, 255);
+
+    size_t ev_size = sizeof(SpallInstantEvent) + trunc_name_len + trunc_args_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Instant;
+    ev->event.category = 0;
+    ev->event.pid = pid;
+    ev->event.tid = tid;
+    ev->event.when = when;
+    ev->event.name_length = trunc_name_len;
+    ev->event.args_length = trunc_args_len;
+    memcpy(ev->name_bytes,                  name, trunc_name_len);
+    memcpy(ev->name_bytes + trunc_name_len, args, trunc_args_len);
+
+    return ev_size;
+}
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_complete(void *buffer, size_t rem_size, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint32_t tid, uint32_t pid) {
+    SpallCompleteEventMax *ev = (SpallCompleteEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255);
+    uint8_t trunc_args_len = (uint8_t)SPALL_MIN(args_len, 255);
+
+    size_t ev_size = sizeof(SpallCompleteEvent) + trunc_name_len + trunc_args_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Complete;
+    ev->event.category = 0;
+    ev->event.pid = pid;
+    ev->event.tid = tid;
+    ev->event.when = when;
+    ev->event.duration = duration;
+    ev->event.name_length = trunc_name_len;
+    ev->event.args_length = trunc_args_len;
+    memcpy(ev->name_bytes,                  name, trunc_name_len);
+    memcpy(ev->name_bytes + trunc_name_len, args, trunc_args_len);
+
+    return ev_size;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_depth_begin(void *buffer, size_t rem_size, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint16_t depth, uint32_t tid, uint32_t pid) {
+    SpallDepthBeginEventMax *ev = (SpallDepthBeginEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255);
+    uint8_t trunc_args_len = (uint8_t)SPALL_MIN(args_len, 255);
+
+    size_t ev_size = sizeof(SpallDepthBeginEvent) + trunc_name_len + trunc_args_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Depth_Begin;
+    ev->event.category = 0;
+    ev->event.pid = pid;
+    ev->event.tid = tid;
+    ev->event.when = when;
+    ev->event.depth = depth;
+    ev->event.name_length = trunc_name_len;
+    ev->event.args_length = trunc_args_len;
+    memcpy(ev->name_bytes,                  name, trunc_name_len);
+    memcpy(ev->name_bytes + trunc_name_len, args, trunc_args_len);
+
+    return ev_size;
+}
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_sampled_begin(void *buffer, size_t rem_size, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t sample_rate, uint32_t tid, uint32_t pid) {
+    SpallSampledBeginEventMax *ev = (SpallSampledBeginEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255);
+    uint8_t trunc_args_len = (uint8_t)SPALL_MIN(args_len, 255);
+
+    size_t ev_size = sizeof(SpallSampledBeginEvent) + trunc_name_len + trunc_args_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Sampled_Begin;
+    ev->event.category = 0;
+    ev->event.pid = pid;
+    ev->event.tid = tid;
+    ev->event.when = when;
+    ev->event.sample_rate = sample_rate;
+    ev->event.name_length = trunc_name_len;
+    ev->event.args_length = trunc_args_len;
+    memcpy(ev->name_bytes,                  name, trunc_name_len);
+    memcpy(ev->name_bytes + trunc_name_len, args, trunc_args_len);
+
+    return ev_size;
+}
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_depth_complete(void *buffer, size_t rem_size, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint16_t depth, uint32_t tid, uint32_t pid) {
+    SpallDepthCompleteEventMax *ev = (SpallDepthCompleteEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255);
+    uint8_t trunc_args_len = (uint8_t)SPALL_MIN(args_len, 255);
+
+    size_t ev_size = sizeof(SpallDepthCompleteEvent) + trunc_name_len + trunc_args_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Depth_Complete;
+    ev->event.category = 0;
+    ev->event.pid = pid;
+    ev->event.tid = tid;
+    ev->event.when = when;
+    ev->event.duration = duration;
+    ev->event.depth = depth;
+    ev->event.name_length = trunc_name_len;
+    ev->event.args_length = trunc_args_len;
+    memcpy(ev->name_bytes,                  name, trunc_name_len);
+    memcpy(ev->name_bytes + trunc_name_len, args, trunc_args_len);
+
+    return ev_size;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_clock_sync(void *buffer, size_t rem_size, double when, uint64_t monotonic_ns, uint64_t realtime_ns, uint32_t pid) {
+    size_t ev_size = sizeof(SpallClockSyncEvent);
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    SpallClockSyncEvent *ev = (SpallClockSyncEvent *)buffer;
+    ev->type = SpallEventType_Clock_Sync;
+    ev->pid = pid;
+    ev->when = when;
+    ev->monotonic_ns = monotonic_ns;
+    ev->realtime_ns = realtime_ns;
+
+    return ev_size;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_alloc(void *buffer, size_t rem_size, uint8_t type, uint64_t addr, uint64_t size, uint64_t site, double when, uint32_t tid, uint32_t pid) {
+    size_t ev_size = sizeof(SpallAllocEvent);
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    SpallAllocEvent *ev = (SpallAllocEvent *)buffer;
+    ev->type = type;
+    ev->pid = pid;
+    ev->tid = tid;
+    ev->when = when;
+    ev->addr = addr;
+    ev->size = size;
+    ev->site = site;
+
+    return ev_size;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_fiber_switch(void *buffer, size_t rem_size, uint32_t fiber, double when, uint32_t tid, uint32_t pid) {
+    size_t ev_size = sizeof(SpallFiberSwitchEvent);
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    SpallFiberSwitchEvent *ev = (SpallFiberSwitchEvent *)buffer;
+    ev->type = SpallEventType_Fiber_Switch;
+    ev->pid = pid;
+    ev->tid = tid;
+    ev->when = when;
+    ev->fiber = fiber;
+
+    return ev_size;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_name_process(void *buffer, size_t rem_size, const char *name, signed long name_len, int32_t sort_index, uint32_t pid) {
+    SpallNameProcessEventMax *ev = (SpallNameProcessEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255); // will be interpreted as truncated in the app (?)
+
+    size_t ev_size = sizeof(SpallNameProcessEvent) + trunc_name_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Name_Process;
+    ev->event.pid = pid;
+    ev->event.sort_index = sort_index;
+    ev->event.name_length = trunc_name_len;
+    memcpy(ev->name_bytes, name, trunc_name_len);
+
+    return ev_size;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall_build_name_thread(void *buffer, size_t rem_size, const char *name, signed long name_len, int32_t sort_index, uint32_t tid, uint32_t pid) {
+    SpallNameThreadEventMax *ev = (SpallNameThreadEventMax *)buffer;
+    uint8_t trunc_name_len = (uint8_t)SPALL_MIN(name_len, 255); // will be interpreted as truncated in the app (?)
+
+    size_t ev_size = sizeof(SpallNameThreadEvent) + trunc_name_len;
+    if (ev_size > rem_size) {
+        return 0;
+    }
+
+    ev->event.type = SpallEventType_Name_Thread;
+    ev->event.pid = pid;
+    ev->event.tid = tid;
+    ev->event.sort_index = sort_index;
+    ev->event.name_length = trunc_name_len;
+    memcpy(ev->name_bytes, name, trunc_name_len);
+
+    return ev_size;
+}
+
 SPALL_FN void spall_quit(SpallProfile *ctx) {
     if (!ctx) return;
+    spall_report_stats(ctx);
     if (ctx->close) ctx->close(ctx);
 
     memset(ctx, 0, sizeof(*ctx));
@@ -304,6 +1517,7 @@ SPALL_FN SpallProfile spall_init_callbacks(double timestamp_unit,
     if (timestamp_unit < 0) return ctx;
     ctx.timestamp_unit = timestamp_unit;
     ctx.is_json = is_json;
+    ctx.enabled = true;
     ctx.data = userdata;
     ctx.write = write;
     ctx.flush = flush;
@@ -337,6 +1551,233 @@ SPALL_FN SpallProfile spall_init_file_ex(const char *filename, double timestamp_
 SPALL_FN SpallProfile spall_init_file     (const char* filename, double timestamp_unit) { return spall_init_file_ex(filename, timestamp_unit, false); }
 SPALL_FN SpallProfile spall_init_file_json(const char* filename, double timestamp_unit) { return spall_init_file_ex(filename, timestamp_unit, true); }
 
+#if !defined(_WIN32)
+// fd sinks write straight to a pipe or socket (ie: tools/relay, for watching a live trace).
+// ctx->data holds fd + 1, so an fd of 0 doesn't look like a closed profile.
+SPALL_FN bool spall__fd_write(SpallProfile *ctx, const void *p, size_t n) {
+    if (!ctx->data) return false;
+    int fd = (int)((intptr_t)ctx->data - 1);
+
+    // if the reader's behind, give up before writing anything, half a flush would wreck the stream
+    if (ctx->backpressure != SpallBackpressure_Block) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLOUT)) return false;
+    }
+
+    const char *bytes = (const char *)p;
+    while (n > 0) {
+#ifdef MSG_NOSIGNAL
+        // a reader going away shouldn't SIGPIPE the program we're tracing
+        ssize_t written = send(fd, bytes, n, MSG_NOSIGNAL);
+        if (written < 0 && errno == ENOTSOCK) written = write(fd, bytes, n);
+#else
+        ssize_t written = write(fd, bytes, n);
+#endif
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+
+        bytes += written;
+        n -= (size_t)written;
+    }
+    return true;
+}
+SPALL_FN bool spall__fd_flush(SpallProfile *ctx) {
+    return ctx->data != NULL;
+}
+SPALL_FN void spall__fd_close(SpallProfile *ctx) {
+    if (!ctx->data) return;
+
+    // no seeking back over the trailing comma here, the viewer doesn't need the closing brackets anyway
+    close((int)((intptr_t)ctx->data - 1));
+    ctx->data = NULL;
+}
+
+// Takes ownership of fd, spall_quit closes it
+SPALL_FN SpallProfile spall_init_fd_ex(int fd, double timestamp_unit, bool is_json) {
+    SpallProfile ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    if (fd < 0) return ctx;
+    return spall_init_callbacks(timestamp_unit, spall__fd_write, spall__fd_flush, spall__fd_close, (void *)((intptr_t)fd + 1), is_json);
+}
+
+SPALL_FN SpallProfile spall_init_fd     (int fd, double timestamp_unit) { return spall_init_fd_ex(fd, timestamp_unit, false); }
+SPALL_FN SpallProfile spall_init_fd_json(int fd, double timestamp_unit) { return spall_init_fd_ex(fd, timestamp_unit, true); }
+#endif
+
+#if defined(__linux__)
+// Shared-memory sinks hand every flush to tools/collector, which merges all of the
+// processes in a session into one trace, so the traced processes never do file I/O.
+// Each process gets a ring at /dev/shm/spall-<session>-<pid>; the collector picks it up,
+// and unlinks it once it's mapped. Every flush is one record: a uint32_t length, then the bytes.
+// A full ring waits on the collector, or for a second after init on one that hasn't shown up yet;
+// past that, flushes that don't fit get dropped.
+// Older glibcs keep shm_open in librt, so link with -lrt there.
+#define SPALL_SHM_MAGIC 0x4D485353 // "SSHM"
+#define SPALL_SHM_VERSION 1
+#define SPALL_SHM_DEFAULT_SIZE (8 * 1024 * 1024)
+#define SPALL_SHM_ATTACH_WAIT_NS 1000000000ull
+
+typedef struct SpallShmRing {
+    uint32_t magic; // = SPALL_SHM_MAGIC, stored last, so the collector doesn't see a half-built ring
+    uint32_t version; // = SPALL_SHM_VERSION
+    uint32_t pid;
+    uint32_t closed; // set once the writer calls spall_quit
+    uint64_t capacity; // bytes of ring after this header, always a power of 2
+    char process_name[64];
+    char shm_name[64];
+    uint8_t pad[40];
+
+    // positions only ever go up, and each side only moves its own, so they get their own cache lines
+    struct { uint64_t pos; uint64_t attach_deadline_ns; uint32_t lock; uint8_t pad[44]; } writer;
+    struct { uint64_t pos; int32_t pid; uint8_t pad[52]; } reader; // pid = 0 until a collector shows up
+} SpallShmRing;
+
+SPALL_FN uint64_t spall__shm_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+SPALL_FN uint8_t *spall__shm_data(SpallShmRing *ring) {
+    return (uint8_t *)(ring + 1);
+}
+
+SPALL_FN void spall__shm_copy_in(SpallShmRing *ring, uint64_t pos, const void *p, size_t n) {
+    size_t offset = (size_t)(pos & (ring->capacity - 1));
+    size_t first = SPALL_MIN(n, (size_t)ring->capacity - offset);
+    memcpy(spall__shm_data(ring) + offset, p, first);
+    memcpy(spall__shm_data(ring), (const char *)p + first, n - first);
+}
+
+// Is anyone still going to make room?
+SPALL_FN bool spall__shm_collector_alive(SpallShmRing *ring) {
+    int32_t pid = __atomic_load_n(&ring->reader.pid, __ATOMIC_ACQUIRE);
+    if (pid == 0) return spall__shm_now_ns() < ring->writer.attach_deadline_ns;
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+SPALL_FN bool spall__shm_write(SpallProfile *ctx, const void *p, size_t n) {
+    SpallShmRing *ring = (SpallShmRing *)ctx->data;
+    if (!ring) return false;
+
+    uint32_t length = (uint32_t)n;
+    uint64_t need = sizeof(length) + n;
+    if (need > ring->capacity) return false;
+
+    // threads in a process share the ring, so flushes take turns
+    while (__atomic_exchange_n(&ring->writer.lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+
+    // wait for the collector to drain enough to fit us, or drop the flush if there's nobody to wait for
+    // (or if we're not supposed to wait at all)
+    uint64_t pos = ring->writer.pos;
+    for (int spins = 0; pos + need - __atomic_load_n(&ring->reader.pos, __ATOMIC_ACQUIRE) > ring->capacity; spins++) {
+        if (ctx->backpressure != SpallBackpressure_Block || ((spins & 1023) == 0 && !spall__shm_collector_alive(ring))) {
+            __atomic_store_n(&ring->writer.lock, 0, __ATOMIC_RELEASE);
+            return false;
+        }
+        sched_yield();
+    }
+
+    spall__shm_copy_in(ring, pos, &length, sizeof(length));
+    spall__shm_copy_in(ring, pos + sizeof(length), p, n);
+    __atomic_store_n(&ring->writer.pos, pos + need, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&ring->writer.lock, 0, __ATOMIC_RELEASE);
+    return true;
+}
+SPALL_FN bool spall__shm_flush(SpallProfile *ctx) {
+    return ctx->data != NULL; // everything's already in shared memory
+}
+SPALL_FN void spall__shm_close(SpallProfile *ctx) {
+    SpallShmRing *ring = (SpallShmRing *)ctx->data;
+    if (!ring) return;
+
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring, sizeof(SpallShmRing) + ring->capacity);
+    ctx->data = NULL;
+}
+
+// session picks which collector gets the trace (NULL for "default"), ring_size gets rounded up to a power of 2
+SPALL_FN SpallProfile spall_init_shm_ex(const char *session, double timestamp_unit, size_t ring_size) {
+    SpallProfile ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    if (!session) session = "default";
+
+    uint64_t capacity = 4096;
+    while (capacity < ring_size) capacity *= 2;
+
+    char shm_name[64];
+    int name_len = snprintf(shm_name, sizeof(shm_name), "/spall-%s-%d", session, (int)getpid());
+    if (name_len <= 0 || name_len >= (int)sizeof(shm_name)) return ctx;
+
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return ctx;
+
+    size_t map_size = sizeof(SpallShmRing) + capacity;
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, (off_t)map_size) == 0) {
+        mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink(shm_name);
+        return ctx;
+    }
+
+    SpallShmRing *ring = (SpallShmRing *)mem;
+    ring->version = SPALL_SHM_VERSION;
+    ring->pid = (uint32_t)getpid();
+    ring->capacity = capacity;
+    ring->writer.attach_deadline_ns = spall__shm_now_ns() + SPALL_SHM_ATTACH_WAIT_NS;
+    memcpy(ring->shm_name, shm_name, (size_t)name_len + 1);
+
+    // so the collector can tag the process with something friendlier than a pid
+    FILE *comm = fopen("/proc/self/comm", "r");
+    if (comm) {
+        if (fgets(ring->process_name, sizeof(ring->process_name), comm)) {
+            ring->process_name[strcspn(ring->process_name, "\n")] = '\0';
+        }
+        fclose(comm);
+    }
+    __atomic_store_n(&ring->magic, SPALL_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return spall_init_callbacks(timestamp_unit, spall__shm_write, spall__shm_flush, spall__shm_close, ring, false);
+}
+
+SPALL_FN SpallProfile spall_init_shm(const char *session, double timestamp_unit) { return spall_init_shm_ex(session, timestamp_unit, SPALL_SHM_DEFAULT_SIZE); }
+#endif
+
+// While disabled, calls return right away without writing anything. A begin picks its zone's fate when it
+// opens: one opened while enabled always gets its end, and one opened while disabled (along with everything
+// inside it) never gets written, whichever way the flag goes before it closes.
+// This is just a store, so it's safe to call from a signal handler.
+SPALL_FN void spall_set_enabled(SpallProfile *ctx, bool enabled) {
+    ctx->enabled = enabled;
+}
+SPALL_FN bool spall_is_enabled(SpallProfile *ctx) {
+    return ctx->enabled;
+}
+
+// SPALL_ENABLE=0 starts with tracing off, anything else turns it on, unset leaves it alone
+SPALL_FN bool spall_set_enabled_from_env(SpallProfile *ctx) {
+    const char *value = getenv("SPALL_ENABLE");
+    if (value) {
+        spall_set_enabled(ctx, strcmp(value, "0") != 0);
+    }
+    return ctx->enabled;
+}
+
+static SpallProfile *spall__signal_ctx;
+SPALL_FN void spall__signal_toggle(int signum) {
+    (void)signum;
+    if (spall__signal_ctx) spall__signal_ctx->enabled = !spall__signal_ctx->enabled;
+}
+// Flips tracing on/off every time signum arrives, ie: SIGUSR2, then kill -USR2 <pid>
+SPALL_FN bool spall_toggle_on_signal(SpallProfile *ctx, int signum) {
+    spall__signal_ctx = ctx;
+    return signal(signum, spall__signal_toggle) != SIG_ERR;
+}
+
 SPALL_FN bool spall_flush(SpallProfile *ctx) {
 #ifdef SPALL_DEBUG
     if (!ctx) return false;
@@ -346,6 +1787,40 @@ SPALL_FN bool spall_flush(SpallProfile *ctx) {
     return true;
 }
 
+// The JSON halves of begin/end stay out of line, so the binary path doesn't pay for their stack frames
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__json_begin(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
+    char buf[1024];
+    int buf_len = snprintf(buf, sizeof(buf),
+                           "{\"ph\":\"B\",\"ts\":%f,\"pid\":%u,\"tid\":%u,\"name\":\"%.*s\",\"args\":\"%.*s\"},\n",
+                           when * ctx->timestamp_unit, pid, tid, (int)SPALL_MIN(name_len, 255), name, (int)SPALL_MIN(args_len, 255), args);
+    if (buf_len <= 0) return false;
+    if (buf_len >= sizeof(buf)) return false;
+    if (!spall__buffer_begin_room(ctx, wb, buf_len, when, tid, pid)) return false;
+    if (!spall__buffer_write(ctx, wb, buf, buf_len)) {
+        wb->depth -= 1;
+        spall__buffer_skip_begin(wb, when, tid, pid);
+        return false;
+    }
+    spall__stats_event(&wb->stats, name_len, args_len);
+    return true;
+}
+
+static SPALL_NOINSTRUMENT SPALL_NOINLINE bool spall__json_end(SpallProfile *ctx, SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+    char buf[512];
+    int buf_len = snprintf(buf, sizeof(buf),
+                           "{\"ph\":\"E\",\"ts\":%f,\"pid\":%u,\"tid\":%u},\n",
+                           when * ctx->timestamp_unit, pid, tid);
+    if (buf_len <= 0) return false;
+    if (buf_len >= sizeof(buf)) return false;
+    if (!spall__buffer_end_room(ctx, wb, when, tid, pid)) return false;
+    if (!spall__buffer_write(ctx, wb, buf, buf_len)) {
+        spall__buffer_drop(wb, 1, when, tid, pid);
+        return false;
+    }
+    spall__stats_event(&wb->stats, 0, 0);
+    return true;
+}
+
 SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_args(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
 #ifdef SPALL_DEBUG
     if (!ctx) return false;
@@ -354,71 +1829,584 @@ SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_args(SpallProfile *ctx, Spall
     if (!wb) return false;
 #endif
 
+    if (!ctx->enabled || wb->off_depth) {
+        wb->off_depth += 1;
+        return true;
+    }
+    if (ctx->is_json) return spall__json_begin(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+
+    size_t size = spall__record_size(sizeof(SpallBeginEvent), name_len, args_len);
+    if (!spall__record_fits(wb, size)) return spall__begin_trimmed(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+    if (!spall__buffer_begin_room(ctx, wb, size, when, tid, pid)) return false;
+
+    wb->head += spall__buffer_build_begin(wb, name, name_len, args, args_len, when, tid, pid);
+    spall__stats_event(&wb->stats, name_len, args_len);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+static bool spall__begin_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
+    spall__record_trim(wb, sizeof(SpallBeginEvent), &name_len, &args_len);
+    return spall_buffer_begin_args(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_ex(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, uint32_t tid, uint32_t pid) {
+    return spall_buffer_begin_args(ctx, wb, name, name_len, "", 0, when, tid, pid);
+}
+
+SPALL_FN bool spall_buffer_begin(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when) {
+    return spall_buffer_begin_args(ctx, wb, name, name_len, "", 0, when, 0, 0);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_end_ex(SpallProfile *ctx, SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!wb) return false;
+#endif
+
+    // ends follow their begin, not the flag
+    if (wb->off_depth) {
+        wb->off_depth -= 1;
+        return true;
+    }
+    if (ctx->is_json) return spall__json_end(ctx, wb, when, tid, pid);
+
+    if (!spall__buffer_end_room(ctx, wb, when, tid, pid)) return false;
+
+    wb->head += spall__buffer_build_end(wb, when, tid, pid);
+    spall__stats_event(&wb->stats, 0, 0);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+
+SPALL_FN bool spall_buffer_end(SpallProfile *ctx, SpallBuffer *wb, double when) { return spall_buffer_end_ex(ctx, wb, when, 0, 0); }
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_complete_args(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!name) return false;
+    if (name_len <= 0) return false;
+    if (!wb) return false;
+    if (duration < 0) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+
     if (ctx->is_json) {
         char buf[1024];
         int buf_len = snprintf(buf, sizeof(buf),
-                               "{\"ph\":\"B\",\"ts\":%f,\"pid\":%u,\"tid\":%u,\"name\":\"%.*s\",\"args\":\"%.*s\"},\n",
-                               when * ctx->timestamp_unit, pid, tid, (int)(uint8_t)name_len, name, (int)(uint8_t)args_len, args);
+                               "{\"ph\":\"X\",\"ts\":%f,\"dur\":%f,\"pid\":%u,\"tid\":%u,\"name\":\"%.*s\",\"args\":\"%.*s\"},\n",
+                               when * ctx->timestamp_unit, duration * ctx->timestamp_unit, pid, tid, (int)SPALL_MIN(name_len, 255), name, (int)SPALL_MIN(args_len, 255), args);
         if (buf_len <= 0) return false;
-        if (buf_len >= sizeof(buf)) return false;
-        if (!spall__buffer_write(ctx, wb, buf, buf_len)) return false;
-    } else {
-        if ((wb->head + sizeof(SpallBeginEventMax)) > wb->length) {
-            if (!spall__buffer_flush(ctx, wb)) {
-                return false;
-            }
+        if (buf_len >= (int)sizeof(buf)) return false;
+        if (!spall__buffer_room(ctx, wb, buf_len, when, tid, pid)) return false;
+        if (!spall__buffer_write(ctx, wb, buf, buf_len)) {
+            spall__buffer_drop(wb, 1, when, tid, pid);
+            return false;
         }
+        spall__stats_event(&wb->stats, name_len, args_len);
+    } else {
+        size_t size = spall__record_size(sizeof(SpallCompleteEvent), name_len, args_len);
+        if (!spall__record_fits(wb, size)) return spall__complete_trimmed(ctx, wb, name, name_len, args, args_len, when, duration, tid, pid);
+        if (!spall__buffer_room(ctx, wb, size, when, tid, pid)) return false;
 
-        wb->head += spall_build_begin((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, args, args_len, when, tid, pid);
+        wb->head += spall_build_complete((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, args, args_len, when, duration, tid, pid);
+        spall__stats_event(&wb->stats, name_len, args_len);
+        spall__buffer_track(wb, when, when + duration);
     }
 
     return true;
 }
+static bool spall__complete_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint32_t tid, uint32_t pid) {
+    spall__record_trim(wb, sizeof(SpallCompleteEvent), &name_len, &args_len);
+    return spall_buffer_complete_args(ctx, wb, name, name_len, args, args_len, when, duration, tid, pid);
+}
 
-SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_ex(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, uint32_t tid, uint32_t pid) {
-    return spall_buffer_begin_args(ctx, wb, name, name_len, "", 0, when, tid, pid);
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_complete_ex(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, double duration, uint32_t tid, uint32_t pid) {
+    return spall_buffer_complete_args(ctx, wb, name, name_len, "", 0, when, duration, tid, pid);
 }
 
-SPALL_FN bool spall_buffer_begin(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when) {
-    return spall_buffer_begin_args(ctx, wb, name, name_len, "", 0, when, 0, 0);
+SPALL_FN bool spall_buffer_complete(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, double duration) {
+    return spall_buffer_complete_args(ctx, wb, name, name_len, "", 0, when, duration, 0, 0);
 }
 
-SPALL_FN SPALL_FORCEINLINE bool spall_buffer_end_ex(SpallProfile *ctx, SpallBuffer *wb, double when, uint32_t tid, uint32_t pid) {
+// JSON has nowhere to put the depth, so these write plain B/X events there
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_depth_args(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint16_t depth, uint32_t tid, uint32_t pid) {
 #ifdef SPALL_DEBUG
     if (!ctx) return false;
+    if (!name) return false;
+    if (name_len <= 0) return false;
     if (!wb) return false;
 #endif
 
+    if (!ctx->enabled || wb->off_depth) {
+        wb->off_depth += 1;
+        return true;
+    }
+
     if (ctx->is_json) {
-        char buf[512];
+        return spall_buffer_begin_args(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+    }
+
+    size_t size = spall__record_size(sizeof(SpallDepthBeginEvent), name_len, args_len);
+    if (!spall__record_fits(wb, size)) return spall__begin_depth_trimmed(ctx, wb, name, name_len, args, args_len, when, depth, tid, pid);
+    if (!spall__buffer_begin_room(ctx, wb, size, when, tid, pid)) return false;
+
+    wb->head += spall_build_depth_begin((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, args, args_len, when, depth, tid, pid);
+    spall__stats_event(&wb->stats, name_len, args_len);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+static bool spall__begin_depth_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint16_t depth, uint32_t tid, uint32_t pid) {
+    spall__record_trim(wb, sizeof(SpallDepthBeginEvent), &name_len, &args_len);
+    return spall_buffer_begin_depth_args(ctx, wb, name, name_len, args, args_len, when, depth, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_depth(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, uint16_t depth, uint32_t tid, uint32_t pid) {
+    return spall_buffer_begin_depth_args(ctx, wb, name, name_len, "", 0, when, depth, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_complete_depth_args(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint16_t depth, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!name) return false;
+    if (name_len <= 0) return false;
+    if (!wb) return false;
+    if (duration < 0) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+
+    if (ctx->is_json) {
+        return spall_buffer_complete_args(ctx, wb, name, name_len, args, args_len, when, duration, tid, pid);
+    }
+
+    size_t size = spall__record_size(sizeof(SpallDepthCompleteEvent), name_len, args_len);
+    if (!spall__record_fits(wb, size)) return spall__complete_depth_trimmed(ctx, wb, name, name_len, args, args_len, when, duration, depth, tid, pid);
+    if (!spall__buffer_room(ctx, wb, size, when, tid, pid)) return false;
+
+    wb->head += spall_build_depth_complete((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, args, args_len, when, duration, depth, tid, pid);
+    spall__stats_event(&wb->stats, name_len, args_len);
+    spall__buffer_track(wb, when, when + duration);
+    return true;
+}
+static bool spall__complete_depth_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, double duration, uint16_t depth, uint32_t tid, uint32_t pid) {
+    spall__record_trim(wb, sizeof(SpallDepthCompleteEvent), &name_len, &args_len);
+    return spall_buffer_complete_depth_args(ctx, wb, name, name_len, args, args_len, when, duration, depth, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_complete_depth(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, double duration, uint16_t depth, uint32_t tid, uint32_t pid) {
+    return spall_buffer_complete_depth_args(ctx, wb, name, name_len, "", 0, when, duration, depth, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_sample(SpallSampler *sampler) {
+    if (sampler->countdown) {
+        sampler->countdown--;
+        return false;
+    }
+
+    sampler->countdown = sampler->rate ? sampler->rate - 1 : 0;
+    return true;
+}
+
+// JSON has nowhere to put the rate, so this writes a plain B event there
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_sampled_args(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t sample_rate, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!name) return false;
+    if (name_len <= 0) return false;
+    if (!wb) return false;
+#endif
+
+    // callers skip the end when we return false, so there's nothing to latch
+    if (!ctx->enabled || wb->off_depth) return false;
+
+    if (ctx->is_json) {
+        return spall_buffer_begin_args(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+    }
+
+    // no skipping the end here, callers only write it if we return true
+    size_t size = spall__record_size(sizeof(SpallSampledBeginEvent), name_len, args_len);
+    if (!spall__record_fits(wb, size)) return spall__begin_sampled_trimmed(ctx, wb, name, name_len, args, args_len, when, sample_rate, tid, pid);
+    if (wb->skip_depth || !spall__buffer_reserve(ctx, wb, size, wb->depth + 1, when, tid, pid)) {
+        spall__buffer_drop(wb, 1, when, tid, pid);
+        return false;
+    }
+    wb->depth += 1;
+
+    wb->head += spall_build_sampled_begin((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, args, args_len, when, sample_rate, tid, pid);
+    spall__stats_event(&wb->stats, name_len, args_len);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+static bool spall__begin_sampled_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t sample_rate, uint32_t tid, uint32_t pid) {
+    spall__record_trim(wb, sizeof(SpallSampledBeginEvent), &name_len, &args_len);
+    return spall_buffer_begin_sampled_args(ctx, wb, name, name_len, args, args_len, when, sample_rate, tid, pid);
+}
+
+// Returns whether this instance got written, only write its End if it did:
+//     bool sampled = spall_buffer_begin_sampled(&ctx, &buffer, &sampler, "hot", 3, __rdtsc(), tid, 0);
+//     ...
+//     if (sampled) spall_buffer_end_ex(&ctx, &buffer, __rdtsc(), tid, 0);
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_begin_sampled(SpallProfile *ctx, SpallBuffer *wb, SpallSampler *sampler, const char *name, signed long name_len, double when, uint32_t tid, uint32_t pid) {
+    if (!spall_sample(sampler)) return false;
+    return spall_buffer_begin_sampled_args(ctx, wb, name, name_len, "", 0, when, sampler->rate ? sampler->rate : 1, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_instant_args(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!name) return false;
+    if (name_len <= 0) return false;
+    if (!wb) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+
+    if (ctx->is_json) {
+        char buf[1024];
         int buf_len = snprintf(buf, sizeof(buf),
-                               "{\"ph\":\"E\",\"ts\":%f,\"pid\":%u,\"tid\":%u},\n",
-                               when * ctx->timestamp_unit, pid, tid);
+                               "{\"ph\":\"i\",\"s\":\"t\",\"ts\":%f,\"pid\":%u,\"tid\":%u,\"name\":\"%.*s\",\"args\":\"%.*s\"},\n",
+                               when * ctx->timestamp_unit, pid, tid, (int)SPALL_MIN(name_len, 255), name, (int)SPALL_MIN(args_len, 255), args);
         if (buf_len <= 0) return false;
-        if (buf_len >= sizeof(buf)) return false;
-        if (!spall__buffer_write(ctx, wb, buf, buf_len)) return false;
+        if (buf_len >= (int)sizeof(buf)) return false;
+        if (!spall__buffer_room(ctx, wb, buf_len, when, tid, pid)) return false;
+        if (!spall__buffer_write(ctx, wb, buf, buf_len)) {
+            spall__buffer_drop(wb, 1, when, tid, pid);
+            return false;
+        }
+        spall__stats_event(&wb->stats, name_len, args_len);
+        return true;
+    }
+
+    size_t size = spall__record_size(sizeof(SpallInstantEvent), name_len, args_len);
+    if (!spall__record_fits(wb, size)) return spall__instant_trimmed(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+    if (!spall__buffer_room(ctx, wb, size, when, tid, pid)) return false;
+
+    wb->head += spall_build_instant((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, args, args_len, when, tid, pid);
+    spall__stats_event(&wb->stats, name_len, args_len);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+static bool spall__instant_trimmed(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, const char *args, signed long args_len, double when, uint32_t tid, uint32_t pid) {
+    spall__record_trim(wb, sizeof(SpallInstantEvent), &name_len, &args_len);
+    return spall_buffer_instant_args(ctx, wb, name, name_len, args, args_len, when, tid, pid);
+}
+
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_instant_ex(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, double when, uint32_t tid, uint32_t pid) {
+    return spall_buffer_instant_args(ctx, wb, name, name_len, "", 0, when, tid, pid);
+}
+
+// Written to the front of the first flush that goes through after a drop, at the time of the last event we lost.
+// It skips the usual checks, we only get here from a flush, so there's nothing else in the buffer yet.
+SPALL_FN void spall__buffer_drop_marker(SpallProfile *ctx, SpallBuffer *wb) {
+    char name[64];
+    int name_len = snprintf(name, sizeof(name), "%llu events dropped", (unsigned long long)wb->drops);
+    uint32_t pid = wb->tag_blocks ? wb->pid : wb->drop_pid;
+    uint32_t tid = wb->tag_blocks ? wb->tid : wb->drop_tid;
+
+    if (ctx->is_json) {
+        char buf[256];
+        int buf_len = snprintf(buf, sizeof(buf),
+                               "{\"ph\":\"i\",\"s\":\"t\",\"ts\":%f,\"pid\":%u,\"tid\":%u,\"name\":\"%.*s\"},\n",
+                               wb->drop_when * ctx->timestamp_unit, pid, tid, name_len, name);
+        if (buf_len <= 0 || wb->head + (size_t)buf_len > wb->length) return;
+        memcpy((char *)wb->data + wb->head, buf, buf_len);
+        wb->head += buf_len;
     } else {
-        if ((wb->head + sizeof(SpallEndEvent)) > wb->length) {
-            if (!spall__buffer_flush(ctx, wb)) {
-                return false;
-            }
+        size_t ev_size = spall_build_instant((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, "", 0, wb->drop_when, tid, pid);
+        if (!ev_size) return;
+        wb->head += ev_size;
+        spall__buffer_track(wb, wb->drop_when, wb->drop_when);
+    }
+    wb->drops = 0;
+}
+
+SPALL_FN bool spall_buffer_name_process_ex(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, int32_t sort_index, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!name) return false;
+    if (name_len < 0) return false;
+    if (!wb) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+
+    if (ctx->is_json) {
+        char buf[1024];
+        int buf_len = 0;
+        if (name_len > 0) {
+            buf_len = snprintf(buf, sizeof(buf),
+                               "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":\"%.*s\"}},\n",
+                               pid, (int)SPALL_MIN(name_len, 255), name);
+        }
+        if (sort_index != 0) {
+            buf_len += snprintf(buf + buf_len, sizeof(buf) - buf_len,
+                                "{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":%u,\"tid\":0,\"args\":{\"sort_index\":%d}},\n",
+                                pid, sort_index);
+        }
+        if (buf_len <= 0) return buf_len == 0;
+        if (buf_len >= (int)sizeof(buf)) return false;
+        if (!spall__buffer_write(ctx, wb, buf, buf_len)) {
+            spall__buffer_drop(wb, 1, wb->drop_when, wb->drop_tid, pid);
+            return false;
+        }
+        spall__stats_event(&wb->stats, name_len, 0);
+        return true;
+    }
+
+    size_t size = spall__record_size(sizeof(SpallNameProcessEvent), name_len, 0);
+    if (!spall__record_fits(wb, size)) {
+        signed long no_args = 0;
+        spall__record_trim(wb, sizeof(SpallNameProcessEvent), &name_len, &no_args);
+        size = sizeof(SpallNameProcessEvent) + (size_t)name_len;
+    }
+    if (!spall__buffer_room(ctx, wb, size, wb->drop_when, wb->drop_tid, pid)) return false;
+
+    wb->head += spall_build_name_process((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, sort_index, pid);
+    spall__stats_event(&wb->stats, name_len, 0);
+    return true;
+}
+
+SPALL_FN bool spall_buffer_name_process(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, uint32_t pid) {
+    return spall_buffer_name_process_ex(ctx, wb, name, name_len, 0, pid);
+}
+
+SPALL_FN bool spall_buffer_name_thread_ex(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, int32_t sort_index, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!name) return false;
+    if (name_len < 0) return false;
+    if (!wb) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+
+    if (ctx->is_json) {
+        char buf[1024];
+        int buf_len = 0;
+        if (name_len > 0) {
+            buf_len = snprintf(buf, sizeof(buf),
+                               "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%.*s\"}},\n",
+                               pid, tid, (int)SPALL_MIN(name_len, 255), name);
         }
+        if (sort_index != 0) {
+            buf_len += snprintf(buf + buf_len, sizeof(buf) - buf_len,
+                                "{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":%u,\"tid\":%u,\"args\":{\"sort_index\":%d}},\n",
+                                pid, tid, sort_index);
+        }
+        if (buf_len <= 0) return buf_len == 0;
+        if (buf_len >= (int)sizeof(buf)) return false;
+        if (!spall__buffer_write(ctx, wb, buf, buf_len)) {
+            spall__buffer_drop(wb, 1, wb->drop_when, tid, pid);
+            return false;
+        }
+        spall__stats_event(&wb->stats, name_len, 0);
+        return true;
+    }
 
-        wb->head += spall_build_end((char *)wb->data + wb->head, wb->length - wb->head, when, tid, pid);
+    size_t size = spall__record_size(sizeof(SpallNameThreadEvent), name_len, 0);
+    if (!spall__record_fits(wb, size)) {
+        signed long no_args = 0;
+        spall__record_trim(wb, sizeof(SpallNameThreadEvent), &name_len, &no_args);
+        size = sizeof(SpallNameThreadEvent) + (size_t)name_len;
     }
+    if (!spall__buffer_room(ctx, wb, size, wb->drop_when, tid, pid)) return false;
 
+    wb->head += spall_build_name_thread((char *)wb->data + wb->head, wb->length - wb->head, name, name_len, sort_index, tid, pid);
+    spall__stats_event(&wb->stats, name_len, 0);
     return true;
 }
 
-SPALL_FN bool spall_buffer_end(SpallProfile *ctx, SpallBuffer *wb, double when) { return spall_buffer_end_ex(ctx, wb, when, 0, 0); }
+SPALL_FN bool spall_buffer_name_thread(SpallProfile *ctx, SpallBuffer *wb, const char *name, signed long name_len, uint32_t tid, uint32_t pid) {
+    return spall_buffer_name_thread_ex(ctx, wb, name, name_len, 0, tid, pid);
+}
+
+// JSON traces are already in microseconds of one clock, so there's nothing to write there
+SPALL_FN bool spall_buffer_clock_sync_ex(SpallProfile *ctx, SpallBuffer *wb, double when, uint64_t monotonic_ns, uint64_t realtime_ns, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!wb) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+    if (ctx->is_json) return true;
+
+    if (!spall__buffer_room(ctx, wb, sizeof(SpallClockSyncEvent), when, wb->drop_tid, pid)) return false;
+
+    wb->head += spall_build_clock_sync((char *)wb->data + wb->head, wb->length - wb->head, when, monotonic_ns, realtime_ns, pid);
+    spall__stats_event(&wb->stats, 0, 0);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+
+// JSON traces don't have anywhere to put heap traffic, so these only write into binary traces
+SPALL_FN bool spall__buffer_alloc(SpallProfile *ctx, SpallBuffer *wb, uint8_t type, void *addr, uint64_t size, void *site, double when, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!wb) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+    if (ctx->is_json) return true;
+
+    if (!spall__buffer_room(ctx, wb, sizeof(SpallAllocEvent), when, tid, pid)) return false;
+
+    wb->head += spall_build_alloc((char *)wb->data + wb->head, wb->length - wb->head, type, (uint64_t)(uintptr_t)addr, size, (uint64_t)(uintptr_t)site, when, tid, pid);
+    spall__stats_event(&wb->stats, 0, 0);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+
+SPALL_FN bool spall_buffer_alloc(SpallProfile *ctx, SpallBuffer *wb, void *addr, uint64_t size, void *site, double when, uint32_t tid, uint32_t pid) {
+    return spall__buffer_alloc(ctx, wb, SpallEventType_Alloc, addr, size, site, when, tid, pid);
+}
+
+SPALL_FN bool spall_buffer_free(SpallProfile *ctx, SpallBuffer *wb, void *addr, uint64_t size, void *site, double when, uint32_t tid, uint32_t pid) {
+    return spall__buffer_alloc(ctx, wb, SpallEventType_Free, addr, size, site, when, tid, pid);
+}
+
+// Call on every resume (and with fiber 0 when the thread goes back to its own stack). Nesting stays
+// per-fiber, so a zone can stay open across a suspend, and pick back up on whichever thread resumes it.
+// Drop policies still count depth per buffer, so a fiber that moves threads can leave a dropped begin's end behind.
+// JSON traces don't have fibers, so this only writes into binary traces.
+SPALL_FN SPALL_FORCEINLINE bool spall_buffer_fiber_switch(SpallProfile *ctx, SpallBuffer *wb, uint32_t fiber, double when, uint32_t tid, uint32_t pid) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return false;
+    if (!wb) return false;
+#endif
+
+    if (!ctx->enabled) return true;
+    if (ctx->is_json) return true;
+
+    if (!spall__buffer_room(ctx, wb, sizeof(SpallFiberSwitchEvent), when, tid, pid)) return false;
+
+    wb->head += spall_build_fiber_switch((char *)wb->data + wb->head, wb->length - wb->head, fiber, when, tid, pid);
+    spall__stats_event(&wb->stats, 0, 0);
+    spall__buffer_track(wb, when, when);
+    return true;
+}
+
+SPALL_FN SPALL_FORCEINLINE size_t spall__batch_event_size(const SpallBatch *batch, size_t i) {
+    switch (batch->types[i]) {
+    case SpallEventType_Begin:
+    case SpallEventType_Instant: return sizeof(SpallBeginEvent) + batch->name_lengths[batch->name_ids[i]];
+    case SpallEventType_End:     return sizeof(SpallEndEvent);
+    default:                     return 0;
+    }
+}
+
+// Sizes up as many events as fit in the buffer, then writes them back to back, with each header
+// built on the stack and stored in one go, and none of the per-event room checks.
+// Anything that has to look at events one at a time (JSON, drop policies, per-cpu buffers) goes the slow way.
+// Returns how many events made it, short of batch->count if the sink failed, or at the first type it doesn't know.
+SPALL_FN size_t spall_buffer_batch(SpallProfile *ctx, SpallBuffer *wb, const SpallBatch *batch) {
+#ifdef SPALL_DEBUG
+    if (!ctx) return 0;
+    if (!wb) return 0;
+    if (!batch) return 0;
+#endif
+
+    // while disabled (or inside a zone that was), begins and ends have to be matched up one by one
+    bool one_at_a_time = ctx->is_json || ctx->backpressure != SpallBackpressure_Block || wb->skip_depth || !ctx->enabled || wb->off_depth;
+#if defined(SPALL_PERCPU)
+    one_at_a_time |= wb->cpus != NULL;
+#endif
+    if (one_at_a_time) {
+        for (size_t i = 0; i < batch->count; i++) {
+            uint32_t name_id = batch->name_ids[i];
+            bool ok = false;
+            switch (batch->types[i]) {
+            case SpallEventType_Begin:   ok = spall_buffer_begin_ex(ctx, wb, batch->names[name_id], batch->name_lengths[name_id], batch->whens[i], batch->tids[i], batch->pid); break;
+            case SpallEventType_Instant: ok = spall_buffer_instant_ex(ctx, wb, batch->names[name_id], batch->name_lengths[name_id], batch->whens[i], batch->tids[i], batch->pid); break;
+            case SpallEventType_End:     ok = spall_buffer_end_ex(ctx, wb, batch->whens[i], batch->tids[i], batch->pid); break;
+            }
+            if (!ok) return i;
+        }
+        return batch->count;
+    }
+
+    size_t i = 0;
+    while (i < batch->count) {
+        size_t room = wb->length - wb->head;
+        size_t run_end = i;
+        size_t run_size = 0;
+        bool bad_type = false;
+        for (; run_end < batch->count; run_end++) {
+            size_t size = spall__batch_event_size(batch, run_end);
+            if (!size) {
+                bad_type = true;
+                break;
+            }
+            if (run_size + size > room) break;
+            run_size += size;
+        }
+
+        if (run_end == i) {
+            if (bad_type) return i;
+
+            // nothing fits, so make room, unless there's no more room to make
+            bool was_empty = wb->head == (spall__buffer_has_blocks(ctx, wb) ? sizeof(SpallBlockHeader) : 0);
+            if (was_empty || !spall__buffer_flush(ctx, wb)) return i;
+            continue;
+        }
+
+        size_t run_start = i;
+        char *out = (char *)wb->data + wb->head;
+        double min_when = batch->whens[i];
+        double max_when = batch->whens[i];
+        for (; i < run_end; i++) {
+            uint8_t type = batch->types[i];
+            double when = batch->whens[i];
+            min_when = when < min_when ? when : min_when;
+            max_when = when > max_when ? when : max_when;
+
+            if (type == SpallEventType_End) {
+                SpallEndEvent ev = { SpallEventType_End, batch->pid, batch->tids[i], when };
+                memcpy(out, &ev, sizeof(ev));
+                out += sizeof(ev);
+                if (wb->depth) wb->depth -= 1;
+            } else {
+                // instants share the begin layout
+                uint32_t name_id = batch->name_ids[i];
+                uint8_t name_len = batch->name_lengths[name_id];
+                SpallBeginEvent ev = { type, 0, batch->pid, batch->tids[i], when, name_len, 0 };
+                memcpy(out, &ev, sizeof(ev));
+                memcpy(out + sizeof(ev), batch->names[name_id], name_len);
+                out += sizeof(ev) + name_len;
+                wb->depth += type == SpallEventType_Begin;
+            }
+        }
+
+        wb->stats.events += run_end - run_start;
+        wb->head += run_size;
+        spall__buffer_track(wb, min_when, max_when);
+        if (bad_type) return i;
+    }
+    return i;
+}
+
+#if !defined(_WIN32)
+// Samples the system clocks between two reads of yours, and pins them to the midpoint:
+//     spall_buffer_clock_sync(&ctx, &buffer, get_rdtsc, 0);
+SPALL_FN bool spall_buffer_clock_sync(SpallProfile *ctx, SpallBuffer *wb, double (*get_time)(void), uint32_t pid) {
+    struct timespec monotonic, realtime;
+    double before = get_time();
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    double after = get_time();
+
+    uint64_t monotonic_ns = (uint64_t)monotonic.tv_sec * 1000000000ull + (uint64_t)monotonic.tv_nsec;
+    uint64_t realtime_ns = (uint64_t)realtime.tv_sec * 1000000000ull + (uint64_t)realtime.tv_nsec;
+    return spall_buffer_clock_sync_ex(ctx, wb, before + (after - before) / 2, monotonic_ns, realtime_ns, pid);
+}
+#endif
 
 SPALL_FN SPALL_FORCEINLINE void spall__buffer_profile(SpallProfile *ctx, SpallBuffer *wb, double spall_time_begin, double spall_time_end, const char *name, int name_len) {
     // precon: ctx
     // precon: ctx->write
     char temp_buffer_data[2048];
     SpallBuffer temp_buffer = { temp_buffer_data, sizeof(temp_buffer_data) };
-    if (!spall_buffer_begin_ex(ctx, &temp_buffer, name, name_len, spall_time_begin, (uint32_t)(uintptr_t)wb->data, 4222222222)) return;
-    if (!spall_buffer_end_ex(ctx, &temp_buffer, spall_time_end, (uint32_t)(uintptr_t)wb->data, 4222222222)) return;
+    if (!spall_buffer_complete_ex(ctx, &temp_buffer, name, name_len, spall_time_begin, spall_time_end - spall_time_begin, (uint32_t)(uintptr_t)wb->data, 4222222222)) return;
     if (ctx->write) ctx->write(ctx, temp_buffer_data, temp_buffer.head);
 }
 
@@ -9,6 +9,9 @@ import "formats:spall"
 BinaryState :: enum {
 	PartialRead,
 	EventRead,
+	DepthEventRead,
+	BlockRead,
+	MetaRead, // something that isn't an event, and needs nothing else from the event loop
 	Finished,
 	Failure,
 }
@@ -19,13 +22,34 @@ Parser :: struct {
 	total_size: u32,
 
 	intern: INMap,
+
+	// everything in a block is on one thread, so we only look it up once per block
+	block_end: i64,
+	block_pid: u32,
+	block_tid: u32,
+	block_p_idx: int,
+	block_t_idx: int,
+
+	// a block that doesn't fit in this chunk asks for a bigger one
+	want_size: i64,
+
+	// where we started skipping garbage, -1 when we're not.
+	// Only traces that have shown us a block have anything to resync to.
+	seen_block: bool,
+	resync_start: i64,
+	lost_bytes: i64,
+	lost_regions: int,
+	bad_blocks: int,
+
+	// threads currently on a fiber, so traces without any can skip looking
+	running_fibers: int,
 }
 
 real_pos :: #force_inline proc() -> i64 { return bp.pos }
 chunk_pos :: #force_inline proc() -> i64 { return bp.pos - bp.offset }
 
 init_parser :: proc(total_size: u32) -> Parser {
-	p := Parser{total_size = total_size}
+	p := Parser{total_size = total_size, block_p_idx = -1, resync_start = -1}
 	p.intern = in_init(big_global_allocator)
 	return p
 }
@@ -41,6 +65,13 @@ setup_pid :: proc(process_id: u32) -> int {
 	return p_idx
 }
 
+block_thread :: #force_inline proc(process_id, thread_id: u32) -> (int, int, bool) {
+	if bp.block_p_idx >= 0 && real_pos() <= bp.block_end && process_id == bp.block_pid && thread_id == bp.block_tid {
+		return bp.block_p_idx, bp.block_t_idx, true
+	}
+	return 0, 0, false
+}
+
 setup_tid :: proc(p_idx: int, thread_id: u32) -> int {
 	t_idx, ok := vh_find(&processes[p_idx].thread_map, thread_id)
 	if !ok {
@@ -56,6 +87,88 @@ setup_tid :: proc(p_idx: int, thread_id: u32) -> int {
 	return t_idx
 }
 
+setup_fiber :: proc(p_idx: int, fiber_id: u32) -> int {
+	f_idx, ok := vh_find(&processes[p_idx].fiber_map, fiber_id)
+	if !ok {
+		threads := &processes[p_idx].threads
+
+		fiber := init_thread(fiber_id)
+		fiber.is_fiber = true
+		fiber.fiber_events = make([dynamic]FiberEvent, big_global_allocator)
+		fiber.fiber_switches = make([dynamic]FiberSwitch, big_global_allocator)
+		fiber.suspends = make([dynamic]Suspend, big_global_allocator)
+		append(threads, fiber)
+
+		f_idx = len(threads) - 1
+		vh_insert(&processes[p_idx].fiber_map, fiber_id, f_idx)
+	}
+
+	return f_idx
+}
+
+// the fiber track a thread's running, or the thread itself
+fiber_redirect :: #force_inline proc(p_idx, t_idx: int) -> int {
+	if f_idx := processes[p_idx].threads[t_idx].running_fiber; f_idx >= 0 {
+		return f_idx
+	}
+	return t_idx
+}
+
+fiber_track :: proc(process_id, thread_id: u32) -> (int, int, bool) {
+	p_idx, t_idx, in_block := block_thread(process_id, thread_id)
+	if !in_block {
+		ok: bool
+		p_idx, ok = vh_find(&process_map, process_id)
+		if !ok {
+			return 0, 0, false
+		}
+		t_idx, ok = vh_find(&processes[p_idx].thread_map, thread_id)
+		if !ok {
+			return 0, 0, false
+		}
+	}
+
+	f_idx := processes[p_idx].threads[t_idx].running_fiber
+	return p_idx, f_idx, f_idx >= 0
+}
+
+// A thread only runs one fiber at a time, so whatever it was running is suspended from here until something resumes it
+bin_switch_fiber :: proc(p_idx, t_idx: int, fiber_id: u32, timestamp: f64) {
+	p := &processes[p_idx]
+
+	if prev := p.threads[t_idx].running_fiber; prev >= 0 {
+		append(&p.threads[prev].fiber_switches, FiberSwitch{timestamp = timestamp, resumed = false})
+		bp.running_fibers -= 1
+	}
+
+	next := -1
+	if fiber_id != 0 {
+		next = setup_fiber(p_idx, fiber_id)
+		append(&p.threads[next].fiber_switches, FiberSwitch{timestamp = timestamp, resumed = true})
+		bp.running_fibers += 1
+	}
+	p.threads[t_idx].running_fiber = next
+}
+
+bin_hold_fiber_event :: proc(p_idx, f_idx: int, temp_ev: ^TempEvent, depth_tagged: bool) {
+	fev := FiberEvent{
+		type = temp_ev.type,
+		name = temp_ev.name,
+		args = temp_ev.args,
+		timestamp = temp_ev.timestamp * stamp_scale,
+		duration = -1,
+		depth = depth_tagged ? i32(temp_ev.depth) : -1,
+	}
+	if temp_ev.type == .Complete {
+		fev.duration = max(temp_ev.duration * stamp_scale, 0)
+	}
+	if temp_ev.type != .End {
+		event_count += 1
+	}
+
+	append(&processes[p_idx].threads[f_idx].fiber_events, fev)
+}
+
 get_next_event :: proc(chunk: []u8, temp_ev: ^TempEvent) -> BinaryState {
 
 	header_sz := i64(size_of(u64))
@@ -90,6 +203,143 @@ get_next_event :: proc(chunk: []u8, temp_ev: ^TempEvent) -> BinaryState {
 
 		bp.pos += event_sz + event_tail
 		return .EventRead
+	case .Sampled_Begin:
+		event_sz := i64(size_of(spall.Sampled_Begin_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Sampled_Begin_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		name := string(data_start[event_sz:event_sz+i64(event.name_len)])
+		args := string(data_start[event_sz+i64(event.name_len):event_sz+i64(event.name_len)+i64(event.args_len)])
+
+		temp_ev.type = .Begin
+		temp_ev.timestamp = event.time
+		temp_ev.thread_id = event.tid
+		temp_ev.process_id = event.pid
+		temp_ev.name = in_get(&bp.intern, name)
+		temp_ev.args = in_get(&bp.intern, args)
+
+		if event.sample_rate > 1 {
+			vh_insert(&sample_rates, temp_ev.name.start, int(event.sample_rate))
+		}
+
+		bp.pos += event_sz + event_tail
+		return .EventRead
+	case .Complete:
+		event_sz := i64(size_of(spall.Complete_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Complete_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		name := string(data_start[event_sz:event_sz+i64(event.name_len)])
+		args := string(data_start[event_sz+i64(event.name_len):event_sz+i64(event.name_len)+i64(event.args_len)])
+
+		temp_ev.type = .Complete
+		temp_ev.timestamp = event.time
+		temp_ev.duration = event.duration
+		temp_ev.thread_id = event.tid
+		temp_ev.process_id = event.pid
+		temp_ev.name = in_get(&bp.intern, name)
+		temp_ev.args = in_get(&bp.intern, args)
+
+		bp.pos += event_sz + event_tail
+		return .EventRead
+	case .Depth_Begin:
+		event_sz := i64(size_of(spall.Depth_Begin_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Depth_Begin_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		name := string(data_start[event_sz:event_sz+i64(event.name_len)])
+		args := string(data_start[event_sz+i64(event.name_len):event_sz+i64(event.name_len)+i64(event.args_len)])
+
+		temp_ev.type = .Begin
+		temp_ev.timestamp = event.time
+		temp_ev.depth = event.depth
+		temp_ev.thread_id = event.tid
+		temp_ev.process_id = event.pid
+		temp_ev.name = in_get(&bp.intern, name)
+		temp_ev.args = in_get(&bp.intern, args)
+
+		bp.pos += event_sz + event_tail
+		return .DepthEventRead
+	case .Depth_Complete:
+		event_sz := i64(size_of(spall.Depth_Complete_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Depth_Complete_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		name := string(data_start[event_sz:event_sz+i64(event.name_len)])
+		args := string(data_start[event_sz+i64(event.name_len):event_sz+i64(event.name_len)+i64(event.args_len)])
+
+		temp_ev.type = .Complete
+		temp_ev.timestamp = event.time
+		temp_ev.duration = event.duration
+		temp_ev.depth = event.depth
+		temp_ev.thread_id = event.tid
+		temp_ev.process_id = event.pid
+		temp_ev.name = in_get(&bp.intern, name)
+		temp_ev.args = in_get(&bp.intern, args)
+
+		bp.pos += event_sz + event_tail
+		return .DepthEventRead
+	case .Block:
+		event_sz := i64(size_of(spall.Block_Header))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		block := (^spall.Block_Header)(raw_data(data_start))
+		if block.magic != spall.BLOCK_MAGIC {
+			return .Failure
+		}
+
+		// a length running off the end of the file is either garbage or a block we lost to truncation,
+		// and one past the cap is garbage that would have us pull in most of the file as one chunk
+		block_sz := event_sz + i64(block.length)
+		if block.length > spall.MAX_BLOCK_SIZE || real_pos() + block_sz > i64(bp.total_size) {
+			return .Failure
+		}
+		if chunk_pos() + block_sz > i64(len(chunk)) {
+			bp.want_size = block_sz
+			return .PartialRead
+		}
+
+		if !spall.block_crc_ok(data_start[:block_sz]) {
+			fmt.printf("Block @ byte %d failed its checksum [pid: %d, tid: %d, %d bytes]\n", real_pos(), block.pid, block.tid, block_sz)
+			bp.bad_blocks += 1
+			return .Failure
+		}
+
+		temp_ev.thread_id = block.tid
+		temp_ev.process_id = block.pid
+
+		bp.pos += event_sz
+		bp.block_end = bp.pos + i64(block.length)
+		return .BlockRead
 	case .End:
 		event_sz := i64(size_of(spall.End_Event))
 		if chunk_pos() + event_sz > i64(len(chunk)) {
@@ -104,6 +354,116 @@ get_next_event :: proc(chunk: []u8, temp_ev: ^TempEvent) -> BinaryState {
 		
 		bp.pos += event_sz
 		return .EventRead
+	case .Clock_Sync:
+		event_sz := i64(size_of(spall.Clock_Sync_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Clock_Sync_Event)(raw_data(data_start))
+
+		append(&clock_syncs, ClockSync{pid = event.pid, timestamp = event.time * stamp_scale, monotonic_ns = event.monotonic_ns})
+
+		bp.pos += event_sz
+		return .MetaRead
+	case .Instant:
+		event_sz := i64(size_of(spall.Instant_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Instant_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		// instants don't touch the event stacks, so they go straight onto their thread
+		p_idx := setup_pid(event.pid)
+		t_idx := fiber_redirect(p_idx, setup_tid(p_idx, event.tid))
+		name := string(data_start[event_sz:event_sz+i64(event.name_len)])
+		append(&processes[p_idx].threads[t_idx].instants, Instant{name = in_get(&bp.intern, name), timestamp = event.time * stamp_scale})
+		instant_count += 1
+
+		bp.pos += event_sz + event_tail
+		return .MetaRead
+	case .Alloc, .Free:
+		event_sz := i64(size_of(spall.Alloc_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Alloc_Event)(raw_data(data_start))
+
+		size := i64(event.size)
+		if event.type == .Free {
+			size = -size
+		}
+
+		p_idx := setup_pid(event.pid)
+		t_idx := fiber_redirect(p_idx, setup_tid(p_idx, event.tid))
+		append(&processes[p_idx].threads[t_idx].mem_events, MemEvent{timestamp = event.time * stamp_scale, size = size})
+		mem_event_count += 1
+
+		bp.pos += event_sz
+		return .MetaRead
+	case .Fiber_Switch:
+		event_sz := i64(size_of(spall.Fiber_Switch_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Fiber_Switch_Event)(raw_data(data_start))
+
+		p_idx, t_idx, in_block := block_thread(event.pid, event.tid)
+		if !in_block {
+			p_idx = setup_pid(event.pid)
+			t_idx = setup_tid(p_idx, event.tid)
+		}
+		bin_switch_fiber(p_idx, t_idx, event.fiber, event.time * stamp_scale)
+
+		bp.pos += event_sz
+		return .MetaRead
+	case .Name_Process:
+		event_sz := i64(size_of(spall.Name_Process_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Name_Process_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		p_idx := setup_pid(event.pid)
+		process := &processes[p_idx]
+		if event.name_len > 0 {
+			process.name = in_get(&bp.intern, string(data_start[event_sz:event_sz+event_tail]))
+		}
+		process.sort_index = event.sort_index
+
+		bp.pos += event_sz + event_tail
+		return .MetaRead
+	case .Name_Thread:
+		event_sz := i64(size_of(spall.Name_Thread_Event))
+		if chunk_pos() + event_sz > i64(len(chunk)) {
+			return .PartialRead
+		}
+		event := (^spall.Name_Thread_Event)(raw_data(data_start))
+
+		event_tail := i64(event.name_len)
+		if (chunk_pos() + event_sz + event_tail) > i64(len(chunk)) {
+			return .PartialRead
+		}
+
+		p_idx := setup_pid(event.pid)
+		t_idx := setup_tid(p_idx, event.tid)
+		thread := &processes[p_idx].threads[t_idx]
+		if event.name_len > 0 {
+			thread.name = in_get(&bp.intern, string(data_start[event_sz:event_sz+event_tail]))
+		}
+		thread.sort_index = event.sort_index
+
+		bp.pos += event_sz + event_tail
+		return .MetaRead
 	case:
 		return .Failure
 	}
@@ -111,18 +471,57 @@ get_next_event :: proc(chunk: []u8, temp_ev: ^TempEvent) -> BinaryState {
 	return .PartialRead
 }
 
+// Scans for the next block header after garbage, returns false if we need the next chunk first
+bin_resync :: proc(chunk: []u8) -> bool {
+	magic_sz := i64(size_of(spall.Event_Type) + size_of(u32))
+
+	i := chunk_pos()
+	for ; i + magic_sz <= i64(len(chunk)); i += 1 {
+		if spall.Event_Type(chunk[i]) == .Block && (^u32)(raw_data(chunk[i+1:]))^ == spall.BLOCK_MAGIC {
+			bp.pos = bp.offset + i
+			return true
+		}
+	}
+
+	// a header could be straddling the end of the chunk, so start the next scan a little early
+	bp.pos = bp.offset + max(chunk_pos(), i64(len(chunk)) - magic_sz + 1)
+	return false
+}
+
 load_binary_chunk :: proc(chunk: []u8) {
 	temp_ev := TempEvent{}
 	ev := Event{}
 
 	full_chunk := chunk
 	load_loop: for bp.pos < i64(bp.total_size) {
+		if bp.resync_start >= 0 && !bin_resync(full_chunk) {
+			// a live trace might just not have the next block yet
+			if bp.pos == last_read && !live_mode {
+				break load_loop
+			} else {
+				last_read = bp.pos
+			}
+
+			bp.offset = bp.pos
+			progressive_refresh()
+			get_chunk(f64(bp.pos), f64(CHUNK_SIZE))
+			return
+		}
+
 		mem.zero(&temp_ev, size_of(TempEvent))
 		state := get_next_event(full_chunk, &temp_ev)
 
+		if bp.running_fibers > 0 && (state == .EventRead || state == .DepthEventRead) {
+			if p_idx, f_idx, ok := fiber_track(temp_ev.process_id, temp_ev.thread_id); ok {
+				bin_hold_fiber_event(p_idx, f_idx, &temp_ev, state == .DepthEventRead)
+				continue
+			}
+		}
+
 		#partial switch state {
 		case .PartialRead:
-			if bp.pos == last_read {
+			// a live trace's next event might just not be written yet
+			if bp.pos == last_read && !live_mode {
 				fmt.printf("Invalid trailing data? dropping from [%d -> %d] (%d bytes)\n", bp.pos, bp.total_size, i64(bp.total_size) - bp.pos)
 				break load_loop
 			} else {
@@ -130,10 +529,53 @@ load_binary_chunk :: proc(chunk: []u8) {
 			}
 
 			bp.offset = bp.pos
-			get_chunk(f64(bp.pos), f64(CHUNK_SIZE))
+			progressive_refresh()
+			get_chunk(f64(bp.pos), f64(max(CHUNK_SIZE, bp.want_size)))
+			bp.want_size = 0
 			return
 		case .Failure:
-			push_fatal(SpallError.InvalidFile)
+			// without blocks, there's nothing to find past the garbage, so we'd just be quietly throwing out the rest of the file.
+			// (a block that failed its checksum still tells us there are blocks)
+			if !bp.seen_block && bp.bad_blocks == 0 {
+				push_fatal(SpallError.InvalidFile)
+			}
+
+			// garbage, skip ahead to the next block that checks out
+			if bp.resync_start < 0 {
+				bp.resync_start = real_pos()
+			}
+			bp.pos += 1
+			continue
+		case .DepthEventRead:
+			ev.name = temp_ev.name
+			ev.args = temp_ev.args
+			ev.timestamp = temp_ev.timestamp * stamp_scale
+			if temp_ev.type == .Complete {
+				ev.duration = max(temp_ev.duration * stamp_scale, 0)
+			} else {
+				ev.duration = -1
+			}
+
+			bin_push_depth_event(temp_ev.process_id, temp_ev.thread_id, temp_ev.depth, &ev)
+			event_count += 1
+			continue
+		case .BlockRead:
+			bp.seen_block = true
+			if bp.resync_start >= 0 {
+				block_start := real_pos() - i64(size_of(spall.Block_Header))
+				fmt.printf("Skipped %d bytes of corrupt data [%d -> %d]\n", block_start - bp.resync_start, bp.resync_start, block_start)
+				bp.lost_bytes += block_start - bp.resync_start
+				bp.lost_regions += 1
+				bp.resync_start = -1
+			}
+
+			bp.block_pid = temp_ev.process_id
+			bp.block_tid = temp_ev.thread_id
+			bp.block_p_idx = setup_pid(temp_ev.process_id)
+			bp.block_t_idx = setup_tid(bp.block_p_idx, temp_ev.thread_id)
+			continue
+		case .MetaRead:
+			continue
 		}
 
 		#partial switch temp_ev.type {
@@ -150,47 +592,86 @@ load_binary_chunk :: proc(chunk: []u8) {
 			stack_push_back(&thread.bande_q, EVData{idx = e_idx, depth = thread.current_depth - 1, self_time = 0})
 
 			event_count += 1
-		case .End:
-			p_idx, ok1 := vh_find(&process_map, temp_ev.process_id)
-			if !ok1 {
-				fmt.printf("invalid end?\n")
-				continue
-			}
-			t_idx, ok2 := vh_find(&processes[p_idx].thread_map, temp_ev.thread_id)
-			if !ok1 {
-				fmt.printf("invalid end?\n")
-				continue
-			}
+		case .Complete:
+			ev.name = temp_ev.name
+			ev.args = temp_ev.args
+			ev.timestamp = temp_ev.timestamp * stamp_scale
+			ev.duration = max(temp_ev.duration * stamp_scale, 0)
+			ev.self_time = ev.duration
 
-			thread := &processes[p_idx].threads[t_idx]
-			if thread.bande_q.len > 0 {
-				jev_data := stack_pop_back(&thread.bande_q)
-				thread.current_depth -= 1
+			p_idx, t_idx, _ := bin_push_event(temp_ev.process_id, temp_ev.thread_id, &ev)
 
-				depth := &thread.depths[thread.current_depth]
-				jev := &depth.bs_events[jev_data.idx]
-				jev.duration = (temp_ev.timestamp * stamp_scale) - jev.timestamp
-				jev.self_time = jev.duration - jev.self_time
-				thread.max_time = max(thread.max_time, jev.timestamp + jev.duration)
-				total_max_time = max(total_max_time, jev.timestamp + jev.duration)
+			// already closed, so there's nothing to match, just hand our time to the parent
+			thread := &processes[p_idx].threads[t_idx]
+			thread.current_depth -= 1
 
-				if thread.bande_q.len > 0 {
-					parent_depth := &thread.depths[thread.current_depth - 1]
-					parent_ev := stack_peek_back(&thread.bande_q)
+			if thread.bande_q.len > 0 {
+				parent_depth := &thread.depths[thread.current_depth - 1]
+				parent_ev := stack_peek_back(&thread.bande_q)
 
-					pev := &parent_depth.bs_events[parent_ev.idx]
+				pev := &parent_depth.bs_events[parent_ev.idx]
+				pev.self_time += ev.duration
+			}
 
-					pev.self_time += jev.duration
+			event_count += 1
+		case .End:
+			p_idx, t_idx, in_block := block_thread(temp_ev.process_id, temp_ev.thread_id)
+			if !in_block {
+				ok1, ok2: bool
+				p_idx, ok1 = vh_find(&process_map, temp_ev.process_id)
+				if !ok1 {
+					fmt.printf("invalid end?\n")
+					continue
 				}
-			} else {
+				t_idx, ok2 = vh_find(&processes[p_idx].thread_map, temp_ev.thread_id)
+				if !ok2 {
+					fmt.printf("invalid end?\n")
+					continue
+				}
+			}
+
+			thread := &processes[p_idx].threads[t_idx]
+			if !bin_end_event(thread, temp_ev.timestamp * stamp_scale) {
 				fmt.printf("Got unexpected end event! [pid: %d, tid: %d, ts: %f]\n", temp_ev.process_id, temp_ev.thread_id, temp_ev.timestamp)
 			}
 		}
 	}
 
+	bin_replay_fibers()
+
+	if bp.resync_start >= 0 {
+		fmt.printf("Skipped %d bytes of corrupt data [%d -> %d], no good blocks after it\n", i64(bp.total_size) - bp.resync_start, bp.resync_start, bp.total_size)
+		bp.lost_bytes += i64(bp.total_size) - bp.resync_start
+		bp.lost_regions += 1
+		bp.resync_start = -1
+	}
+	if bp.lost_regions > 0 {
+		if event_count == 0 {
+			push_fatal(SpallError.InvalidFile)
+		}
+		fmt.printf("Recovered what we could, lost %d bytes in %d corrupt region(s) (%d block(s) failed their checksum)\n", bp.lost_bytes, bp.lost_regions, bp.bad_blocks)
+	}
+
 	// cleanup unfinished events
 	for process in &processes {
 		for thread in &process.threads {
+			// depth-tagged begins that never got an end, deepest first
+			if thread.bande_q.len == 0 {
+				for ; thread.current_depth > 0; thread.current_depth -= 1 {
+					depth := &thread.depths[thread.current_depth - 1]
+					jev := &depth.bs_events[len(depth.bs_events)-1]
+
+					duration := bound_duration(jev, thread.max_time)
+					jev.self_time = max(duration - jev.self_time, 0)
+
+					if thread.current_depth > 1 {
+						parent_depth := &thread.depths[thread.current_depth - 2]
+						pev := &parent_depth.bs_events[len(parent_depth.bs_events)-1]
+						pev.self_time += duration
+					}
+				}
+			}
+
 			for thread.bande_q.len > 0 {
 				ev_data := stack_pop_back(&thread.bande_q)
 
@@ -220,10 +701,146 @@ load_binary_chunk :: proc(chunk: []u8) {
 	return
 }
 
+// How many instances a sampled event stands in for, 1 for everything else
+sample_rate_of :: proc(name: INStr) -> int {
+	if len(sample_rates.entries) > 0 {
+		if r, ok := vh_find(&sample_rates, name.start); ok {
+			return r
+		}
+	}
+	return 1
+}
+
+// Closes whatever's open on the thread, returns false if nothing was
+bin_end_event :: proc(thread: ^Thread, timestamp: f64) -> bool {
+	if thread.bande_q.len > 0 {
+		jev_data := stack_pop_back(&thread.bande_q)
+		thread.current_depth -= 1
+
+		depth := &thread.depths[thread.current_depth]
+		jev := &depth.bs_events[jev_data.idx]
+		jev.duration = timestamp - jev.timestamp
+		jev.self_time = max(jev.duration - jev.self_time, 0)
+		thread.max_time = max(thread.max_time, jev.timestamp + jev.duration)
+		total_max_time = max(total_max_time, jev.timestamp + jev.duration)
+
+		if thread.bande_q.len > 0 {
+			parent_depth := &thread.depths[thread.current_depth - 1]
+			parent_ev := stack_peek_back(&thread.bande_q)
+
+			pev := &parent_depth.bs_events[parent_ev.idx]
+
+			pev.self_time += jev.duration
+		}
+	} else if thread.current_depth > 0 {
+		// nothing on the stack, so this closes a depth-tagged begin, always the last one at the deepest open depth
+		thread.current_depth -= 1
+
+		depth := &thread.depths[thread.current_depth]
+		jev := &depth.bs_events[len(depth.bs_events)-1]
+		jev.duration = timestamp - jev.timestamp
+		jev.self_time = jev.duration - jev.self_time
+		thread.max_time = max(thread.max_time, jev.timestamp + jev.duration)
+		total_max_time = max(total_max_time, jev.timestamp + jev.duration)
+
+		if thread.current_depth > 0 {
+			parent_depth := &thread.depths[thread.current_depth - 1]
+			pev := &parent_depth.bs_events[len(parent_depth.bs_events)-1]
+			pev.self_time += jev.duration
+		}
+	} else {
+		return false
+	}
+
+	return true
+}
+
+fiber_event_sort_proc :: proc(a, b: FiberEvent) -> bool {
+	return a.timestamp < b.timestamp
+}
+fiber_switch_sort_proc :: proc(a, b: FiberSwitch) -> bool {
+	if a.timestamp != b.timestamp {
+		return a.timestamp < b.timestamp
+	}
+	return !a.resumed && b.resumed
+}
+
+// Fibers hop threads, and every thread flushes on its own schedule, so a fiber's events can come in any order.
+// Once they're all in, they get sorted and pushed like they came off one thread, and the time between
+// each switch away and the next resume turns into a suspend.
+bin_replay_fibers :: proc() {
+	for process, p_idx in &processes {
+		for t_idx := 0; t_idx < len(process.threads); t_idx += 1 {
+			tm := &process.threads[t_idx]
+			if !tm.is_fiber {
+				continue
+			}
+
+			// stable, so a thread's own events stay in the order it wrote them
+			slice.stable_sort_by(tm.fiber_events[:], fiber_event_sort_proc)
+			for fev in tm.fiber_events {
+				ev := Event{name = fev.name, args = fev.args, timestamp = fev.timestamp, duration = fev.duration}
+				if fev.depth >= 0 {
+					bin_push_thread_depth_event(p_idx, t_idx, u16(fev.depth), &ev)
+					continue
+				}
+
+				#partial switch fev.type {
+				case .Begin:
+					e_idx := bin_push_thread_event(p_idx, t_idx, &ev)
+					stack_push_back(&tm.bande_q, EVData{idx = e_idx, depth = tm.current_depth - 1, self_time = 0})
+				case .Complete:
+					ev.self_time = ev.duration
+					bin_push_thread_event(p_idx, t_idx, &ev)
+					tm.current_depth -= 1
+
+					if tm.bande_q.len > 0 {
+						parent_depth := &tm.depths[tm.current_depth - 1]
+						parent_ev := stack_peek_back(&tm.bande_q)
+
+						pev := &parent_depth.bs_events[parent_ev.idx]
+						pev.self_time += ev.duration
+					}
+				case .End:
+					if !bin_end_event(tm, fev.timestamp) {
+						fmt.printf("Got unexpected end event! [pid: %d, fiber: %d, ts: %f]\n", process.process_id, tm.thread_id, fev.timestamp)
+					}
+				}
+			}
+			resize(&tm.fiber_events, 0)
+
+			slice.sort_by(tm.fiber_switches[:], fiber_switch_sort_proc)
+			suspended := false
+			suspended_at: f64
+			for sw in tm.fiber_switches {
+				if !sw.resumed {
+					suspended = true
+					suspended_at = sw.timestamp
+				} else if suspended {
+					append(&tm.suspends, Suspend{start = suspended_at, end = sw.timestamp})
+					suspended = false
+				}
+			}
+
+			// never resumed, so it's out until the end of the trace
+			if suspended {
+				append(&tm.suspends, Suspend{start = suspended_at, end = 0x7fefffffffffffff})
+			}
+		}
+	}
+}
+
 bin_push_event :: proc(process_id, thread_id: u32, event: ^Event) -> (int, int, int) {
-	p_idx := setup_pid(process_id)
-	t_idx := setup_tid(p_idx, thread_id)
+	p_idx, t_idx, in_block := block_thread(process_id, thread_id)
+	if !in_block {
+		p_idx = setup_pid(process_id)
+		t_idx = setup_tid(p_idx, thread_id)
+	}
+
+	return p_idx, t_idx, bin_push_thread_event(p_idx, t_idx, event)
+}
 
+bin_push_thread_event :: proc(p_idx, t_idx: int, event: ^Event) -> int {
 	p := &processes[p_idx]
 	p.min_time = min(p.min_time, event.timestamp)
 
@@ -232,7 +849,7 @@ bin_push_event :: proc(process_id, thread_id: u32, event: ^Event) -> (int, int,
 
 	if t.max_time > event.timestamp {
 		fmt.printf("Woah, time-travel? You just had a begin event that started before a previous one; [pid: %d, tid: %d, name: %s]\n", 
-			process_id, thread_id, in_getstr(event.name))
+			p.process_id, t.thread_id, in_getstr(event.name))
 		push_fatal(SpallError.InvalidFile)
 	}
 	t.max_time = event.timestamp + event.duration
@@ -251,19 +868,262 @@ bin_push_event :: proc(process_id, thread_id: u32, event: ^Event) -> (int, int,
 	t.current_depth += 1
 	append_event(&depth.bs_events, event^)
 
-	return p_idx, t_idx, len(depth.bs_events)-1
+	return len(depth.bs_events)-1
+}
+
+// Depth-tagged events already know where they go, so they skip bande_q entirely.
+// Each depth only has to be in time order, which lets completes show up after their children.
+bin_push_depth_event :: proc(process_id, thread_id: u32, depth_idx: u16, event: ^Event) {
+	p_idx, t_idx, in_block := block_thread(process_id, thread_id)
+	if !in_block {
+		p_idx = setup_pid(process_id)
+		t_idx = setup_tid(p_idx, thread_id)
+	}
+
+	bin_push_thread_depth_event(p_idx, t_idx, depth_idx, event)
+}
+
+bin_push_thread_depth_event :: proc(p_idx, t_idx: int, depth_idx: u16, event: ^Event) {
+	p := &processes[p_idx]
+	p.min_time = min(p.min_time, event.timestamp)
+
+	t := &p.threads[t_idx]
+	t.min_time = min(t.min_time, event.timestamp)
+
+	for int(depth_idx) >= len(t.depths) {
+		depth := Depth{
+			bs_events = make([dynamic]Event, big_global_allocator),
+		}
+		append(&t.depths, depth)
+	}
+
+	depth := &t.depths[depth_idx]
+	if len(depth.bs_events) > 0 {
+		prev := &depth.bs_events[len(depth.bs_events)-1]
+		if prev.timestamp + max(prev.duration, 0) > event.timestamp {
+			fmt.printf("Woah, time-travel? You just had an event that started before the previous one at depth %d ended; [pid: %d, tid: %d, name: %s]\n", 
+				depth_idx, p.process_id, t.thread_id, in_getstr(event.name))
+			push_fatal(SpallError.InvalidFile)
+		}
+	}
+
+	end_time := event.timestamp + max(event.duration, 0)
+	t.max_time = max(t.max_time, end_time)
+	total_min_time = min(total_min_time, event.timestamp)
+	total_max_time = max(total_max_time, end_time)
+
+	// children written before us are waiting on the depth below
+	event.self_time = 0
+	if int(depth_idx) + 1 < len(t.depths) {
+		child_depth := &t.depths[depth_idx + 1]
+		event.self_time = child_depth.pending_child_time
+		child_depth.pending_child_time = 0
+	}
+
+	if event.duration >= 0 {
+		event.self_time = event.duration - event.self_time
+
+		// hand our time to the parent if it's already here, otherwise park it until it shows up
+		if depth_idx > 0 {
+			parent_depth := &t.depths[depth_idx - 1]
+			parent_open := false
+			if len(parent_depth.bs_events) > 0 {
+				pev := &parent_depth.bs_events[len(parent_depth.bs_events)-1]
+				parent_open = pev.timestamp <= event.timestamp && (pev.duration < 0 || pev.timestamp + pev.duration >= end_time)
+				if parent_open {
+					// open parents collect child time until their end, completes already know their self time
+					if pev.duration < 0 {
+						pev.self_time += event.duration
+					} else {
+						pev.self_time -= event.duration
+					}
+				}
+			}
+			if !parent_open {
+				depth.pending_child_time += event.duration
+			}
+		}
+	} else {
+		t.current_depth = depth_idx + 1
+	}
+
+	append_event(&depth.bs_events, event^)
 }
 
 bin_process_events :: proc() {
+	bin_align_clocks()
+
 	for process in &processes {
 		slice.sort_by(process.threads[:], tid_sort_proc)
 		for tm in &process.threads {
+			slice.sort_by(tm.instants[:], instant_rendersort_proc)
 			for depth in &tm.depths {
 				depth.events = depth.bs_events[:]
 			}
 		}
+		bin_build_live_bytes(&process)
 	}
 
 	slice.sort_by(processes[:], pid_sort_proc)
 	return
 }
+
+mem_event_sort_proc :: proc(a, b: MemEvent) -> bool {
+	return a.timestamp < b.timestamp
+}
+mem_sample_sort_proc :: proc(a, b: MemSample) -> bool {
+	return a.timestamp < b.timestamp
+}
+
+// Merges the process's heap traffic into its live bytes track, and keeps a running total
+// of what each thread allocated, so zones can look up their bytes with two searches
+bin_build_live_bytes :: proc(process: ^Process) {
+	resize(&process.live_bytes, 0)
+	process.max_live_bytes = 0
+
+	for tm in &process.threads {
+		slice.sort_by(tm.mem_events[:], mem_event_sort_proc)
+
+		allocated: u64 = 0
+		for ev in &tm.mem_events {
+			if ev.size > 0 {
+				allocated += u64(ev.size)
+			}
+			ev.allocated = allocated
+			append(&process.live_bytes, MemSample{timestamp = ev.timestamp, live_bytes = ev.size})
+		}
+	}
+	if len(process.live_bytes) == 0 {
+		return
+	}
+
+	slice.sort_by(process.live_bytes[:], mem_sample_sort_proc)
+
+	// frees of blocks from before tracing started can take us under zero, so count up from the lowest point
+	live, lowest: i64
+	for sample in &process.live_bytes {
+		live += sample.live_bytes
+		sample.live_bytes = live
+		lowest = min(lowest, live)
+	}
+	for sample in &process.live_bytes {
+		sample.live_bytes -= lowest
+		process.max_live_bytes = max(process.max_live_bytes, sample.live_bytes)
+	}
+}
+
+// Puts each pid that wrote clock syncs onto CLOCK_MONOTONIC (in microseconds), with a least-squares
+// line through its samples, so processes that calibrated their clocks separately still line up.
+// Pids without any syncs keep their own times.
+bin_align_clocks :: proc() {
+	if len(clock_syncs) == 0 {
+		return
+	}
+
+	// Pids without usable syncs stay on their own clock, which can put them far off from the rest,
+	// so they get listed in the toolbar instead of silently sitting in the wrong place
+	ClockFit :: struct { scale, offset: f64 }
+	fits := make([]ClockFit, len(processes), context.temp_allocator)
+	for process, p_idx in &processes {
+		fits[p_idx] = ClockFit{1, 0}
+		if len(process.threads) == 0 {
+			continue
+		}
+
+		sample_count := 0
+		mean_x, mean_y: f64
+		for sync in clock_syncs {
+			if sync.pid != process.process_id {
+				continue
+			}
+			mean_x += sync.timestamp
+			mean_y += f64(sync.monotonic_ns) / 1000
+			sample_count += 1
+		}
+		if sample_count == 0 {
+			fmt.printf("pid %d has no clock syncs, leaving its times alone\n", process.process_id)
+			append(&unaligned_pids, process.process_id)
+			continue
+		}
+		mean_x /= f64(sample_count)
+		mean_y /= f64(sample_count)
+
+		// one sample only gets us an offset, it takes two to see drift
+		sxx, sxy: f64
+		for sync in clock_syncs {
+			if sync.pid != process.process_id {
+				continue
+			}
+			dx := sync.timestamp - mean_x
+			dy := (f64(sync.monotonic_ns) / 1000) - mean_y
+			sxx += dx * dx
+			sxy += dx * dy
+		}
+
+		scale := 1.0
+		if sxx > 0 {
+			scale = sxy / sxx
+		}
+		if scale <= 0 {
+			fmt.printf("Clock syncs for pid %d run backwards, leaving its times alone\n", process.process_id)
+			append(&unaligned_pids, process.process_id)
+			continue
+		}
+		fits[p_idx] = ClockFit{scale, mean_y - (scale * mean_x)}
+	}
+
+	for process, p_idx in &processes {
+		scale := fits[p_idx].scale
+		offset := fits[p_idx].offset
+		if scale == 1 && offset == 0 {
+			continue
+		}
+
+		process.min_time = (process.min_time * scale) + offset
+		for tm in &process.threads {
+			for instant in &tm.instants {
+				instant.timestamp = (instant.timestamp * scale) + offset
+			}
+			for suspend in &tm.suspends {
+				suspend.start = (suspend.start * scale) + offset
+				suspend.end = (suspend.end * scale) + offset
+			}
+			for ev in &tm.mem_events {
+				ev.timestamp = (ev.timestamp * scale) + offset
+			}
+
+			// a block with nothing but ends in it can make a thread without any events
+			if len(tm.depths) == 0 {
+				continue
+			}
+
+			tm.min_time = (tm.min_time * scale) + offset
+			tm.max_time = (tm.max_time * scale) + offset
+			for depth in &tm.depths {
+				for ev in &depth.bs_events {
+					ev.timestamp = (ev.timestamp * scale) + offset
+					if ev.duration >= 0 {
+						ev.duration *= scale
+					}
+					ev.self_time *= scale
+				}
+
+				// anything chunked while we were loading has the old times baked in
+				clear(&depth.tree)
+				depth.levels = 0
+			}
+		}
+	}
+
+	total_min_time = 0x7fefffffffffffff
+	total_max_time = 0
+	for process in processes {
+		for tm in process.threads {
+			if len(tm.depths) == 0 {
+				continue
+			}
+			total_min_time = min(total_min_time, tm.min_time)
+			total_max_time = max(total_max_time, tm.max_time)
+		}
+	}
+}
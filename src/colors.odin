@@ -28,6 +28,8 @@ shadow_color := FVec4{}
 wide_rect_color := FVec4{}
 wide_bg_color := FVec4{}
 rect_tooltip_stats_color := FVec4{}
+instant_color := FVec4{}
+mem_color := FVec4{}
 
 choice_count :: 16
 color_choices: [choice_count]FVec3
@@ -61,6 +63,8 @@ default_colors :: proc "contextless" (is_dark: bool) {
 		xbar_color        = FVec4{180, 180, 180, 255}
 
 		rect_tooltip_stats_color = FVec4{150, 255, 150, 255}
+		instant_color            = FVec4{255,  90,  90, 255}
+		mem_color                = FVec4{ 90, 170, 255, 255}
 	} else {
 		bg_color         = FVec4{254, 252, 248, 255}
 		bg_color2        = FVec4{255, 255, 255, 255}
@@ -87,6 +91,8 @@ default_colors :: proc "contextless" (is_dark: bool) {
 		xbar_color        = FVec4{ 80,  80,  80, 255}
 
 		rect_tooltip_stats_color = FVec4{20, 130, 20, 255}
+		instant_color            = FVec4{200,  30,  30, 255}
+		mem_color                = FVec4{ 40, 110, 200, 255}
 	}
 }
 
@@ -102,8 +108,9 @@ set_color_mode :: proc "contextless" (auto: bool, is_dark: bool) {
 }
 
 // color_choices must be power of 2
-name_color_idx :: proc(name: string) -> u32 {
-	return u32(uintptr(raw_data(name))) & u32(len(color_choices) - 1)
+// Keyed on the string's offset rather than its address, so colors stay put when string_block grows mid-load
+name_color_idx :: proc(name: INStr) -> u32 {
+	return name.start & u32(len(color_choices) - 1)
 }
 
 generate_color_choices :: proc() {
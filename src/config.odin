@@ -41,6 +41,29 @@ start_loading_file :: proc "contextless" (size: u32, name: string) {
 
 }
 
+// The trace is still being written, so we don't know how big it'll get.
+// Chunks show up as the relay gets them, until live_stream_over tells us the final size.
+@export
+start_live_stream :: proc "contextless" (name: string) {
+	context = wasmContext
+	init_loading_state(max(u32), name)
+	live_mode = true
+	live_trace = true
+	get_chunk(0.0, f64(CHUNK_SIZE))
+}
+
+@export
+live_stream_over :: proc "contextless" (size: u32) {
+	context = wasmContext
+	if !live_mode {
+		return
+	}
+
+	live_mode = false
+	bp.total_size = size
+	get_chunk(f64(bp.pos), f64(CHUNK_SIZE))
+}
+
 manual_load :: proc(config, name: string) {
 	init_loading_state(u32(len(config)), name)
 	load_config_chunk(transmute([]u8)config)
@@ -52,7 +75,7 @@ gen_event_color :: proc(events: []Event, thread_max: f64) -> (FVec3, f64) {
 	color := FVec3{}
 	color_weights := [choice_count]f64{}
 	for ev in events {
-		idx := name_color_idx(in_getstr(ev.name))
+		idx := name_color_idx(ev.name)
 
 		duration := f64(bound_duration(ev, thread_max))
 		if duration <= 0 {
@@ -105,170 +128,354 @@ print_tree :: proc(tree: []ChunkNode, head: uint) {
 	fmt.printf("ded!\n")
 }
 
-chunk_events :: proc() {
-	for proc_v, p_idx in &processes {
-		for tm, t_idx in &proc_v.threads {
-			for depth, d_idx in &tm.depths {
-				bucket_count := i_round_up(len(depth.events), BUCKET_SIZE) / BUCKET_SIZE
-
-				// precompute element count for tree
-				max_nodes := bucket_count
-				{
-					row_count := bucket_count
-					parent_row_count := (row_count + (CHUNK_NARY_WIDTH - 1)) / CHUNK_NARY_WIDTH
-					for row_count > 1 {
-						tmp := (row_count + (CHUNK_NARY_WIDTH - 1)) / CHUNK_NARY_WIDTH
-						max_nodes += tmp
-						row_count = parent_row_count
-						parent_row_count = tmp
-					}
+// Trees (and self-times, for JSON) get built a thread at a time, the first time something needs them:
+// when the thread's track scrolls into view, when stats get to it, or when an idle frame works its way down the queue.
+// That way the first frame only pays for what's on screen, not for the whole trace.
+pending_thread_count := 0
+pending_p_idx := 0
+pending_t_idx := 0
+IDLE_PROCESS_MS :: 4
+
+queue_thread_processing :: proc() {
+	// node times are relative to total_min_time, so if that moved, every tree built so far is stale
+	rebuild := total_min_time != tree_min_time
+	tree_min_time = total_min_time
+
+	pending_thread_count = 0
+	pending_p_idx = 0
+	pending_t_idx = 0
+	for proc_v in &processes {
+		for tm in &proc_v.threads {
+			if rebuild {
+				for depth in &tm.depths {
+					clear(&depth.tree)
+					depth.levels = 0
 				}
+			}
 
-				tm.depths[d_idx].tree = make([dynamic]ChunkNode, 0, max_nodes, big_global_allocator)
-				tree := &tm.depths[d_idx].tree
+			// the wide graph and the minimap draw every thread's top depth, so those can't wait
+			if len(tm.depths) > 0 {
+				chunk_depth(&tm, &tm.depths[0])
+			}
+			tm.processed = false
+			pending_thread_count += 1
+		}
+	}
 
-				for i := 0; i < bucket_count; i += 1 {
-					start_idx := i * BUCKET_SIZE
-					end_idx := start_idx + min(len(depth.events) - start_idx, BUCKET_SIZE)
-					scan_arr := depth.events[start_idx:end_idx]
+	if pending_thread_count == 0 {
+		all_threads_processed()
+	}
+}
 
-					start_ev := scan_arr[0]
-					end_ev := scan_arr[len(scan_arr)-1]
+process_thread :: proc(tm: ^Thread) {
+	// nothing's queued while the trace is still loading, progressive_refresh keeps the trees going until then
+	if tm.processed || pending_thread_count == 0 {
+		return
+	}
+
+	for depth, d_idx in &tm.depths {
+		// the top depth got built with the queue
+		if d_idx == 0 {
+			continue
+		}
+		chunk_depth(tm, &depth)
+	}
+	if is_json {
+		generate_selftimes(tm)
+	}
 
-					node := ChunkNode{}
-					node.start_time = start_ev.timestamp - total_min_time
-					node.end_time   = end_ev.timestamp + bound_duration(end_ev, tm.max_time) - total_min_time
-					node.start_idx  = uint(start_idx)
-					node.end_idx    = uint(end_idx)
-					node.arr_len = i8(len(scan_arr))
+	// whole-file stats rewind the big arena to current_alloc_offset, so keep the new trees underneath it
+	current_alloc_offset = max(current_alloc_offset, big_global_arena.offset)
 
-					avg_color, weight := gen_event_color(scan_arr, tm.max_time)
-					node.avg_color = avg_color
-					node.weight = weight
+	tm.processed = true
+	pending_thread_count -= 1
+	if pending_thread_count == 0 {
+		all_threads_processed()
+	}
+}
 
-					append(tree, node)
-				}
+// Works down the queue until budget_ms runs out, always getting at least one thread done
+process_idle_threads :: proc(budget_ms: f64) {
+	start := get_time()
+	for ; pending_p_idx < len(processes); pending_p_idx += 1 {
+		threads := processes[pending_p_idx].threads[:]
+		for ; pending_t_idx < len(threads); pending_t_idx += 1 {
+			if threads[pending_t_idx].processed {
+				continue
+			}
+			if pending_thread_count == 0 || get_time() - start > budget_ms {
+				return
+			}
+			process_thread(&threads[pending_t_idx])
+		}
+		pending_t_idx = 0
+	}
+}
 
-				tree_start_idx := 0
-				tree_end_idx := len(tree)
+process_all_threads :: proc() {
+	for proc_v in &processes {
+		for tm in &proc_v.threads {
+			process_thread(&tm)
+		}
+	}
+}
 
-				row_count := len(tree)
-				parent_row_count := (row_count + (CHUNK_NARY_WIDTH - 1)) / CHUNK_NARY_WIDTH
-				for row_count > 1 {
-					for i := 0; i < parent_row_count; i += 1 {
-						start_idx := tree_start_idx + (i * CHUNK_NARY_WIDTH)
-						end_idx := start_idx + min(tree_end_idx - start_idx, CHUNK_NARY_WIDTH)
+all_threads_processed :: proc() {
+	// lets spall.js know it can snapshot the trace, for next time
+	if !live_trace {
+		trace_loaded()
+	}
+}
 
-						children := tree[start_idx:end_idx]
+tree_node_count :: proc(ev_count: int) -> int {
+	bucket_count := i_round_up(ev_count, BUCKET_SIZE) / BUCKET_SIZE
 
-						start_node := children[0]
-						end_node := children[len(children)-1]
+	max_nodes := bucket_count
+	row_count := bucket_count
+	for row_count > 1 {
+		row_count = (row_count + (CHUNK_NARY_WIDTH - 1)) / CHUNK_NARY_WIDTH
+		max_nodes += row_count
+	}
+	return max_nodes
+}
 
-						node := ChunkNode{}
-						node.start_time = start_node.start_time
-						node.end_time   = end_node.end_time
-						node.start_idx  = start_node.start_idx
-						node.end_idx    = end_node.end_idx
+// Brings a depth's tree up to date with its events.
+// Buckets only ever get added on the right, so everything off of the spine is already final,
+// and the only nodes that need another look are the new ones and the spine itself.
+chunk_depth :: proc(tm: ^Thread, depth: ^Depth) {
+	ev_count := len(depth.events)
+	if ev_count == 0 {
+		return
+	}
 
-						avg_color := FVec3{}
-						for j := 0; j < len(children); j += 1 {
-							node.children[j] = uint(start_idx + j)
-							avg_color += children[j].avg_color * f32(children[j].weight)
-							node.weight += children[j].weight
-						}
-						node.child_count = i8(len(children))
-						node.avg_color = avg_color / f32(node.weight)
+	// most trees get built in one go, so size those exactly
+	if depth.tree == nil {
+		depth.tree = make([dynamic]ChunkNode, 0, tree_node_count(ev_count), big_global_allocator)
+	}
 
-						append(tree, node)
-					}
+	covered := 0
+	if depth.levels > 0 {
+		// top off the last bucket, if it wasn't full
+		last_leaf := &depth.tree[depth.spine[0]]
+		covered = min(ev_count, int(last_leaf.start_idx) + BUCKET_SIZE)
+		last_leaf.end_idx = uint(covered)
+		last_leaf.arr_len = i8(covered - int(last_leaf.start_idx))
+	}
 
-					tree_start_idx = tree_end_idx
-					tree_end_idx = len(tree)
-					row_count = tree_end_idx - tree_start_idx
-					parent_row_count = (row_count + (CHUNK_NARY_WIDTH - 1)) / CHUNK_NARY_WIDTH
-				}
+	for start_idx := covered; start_idx < ev_count; start_idx += BUCKET_SIZE {
+		end_idx := min(ev_count, start_idx + BUCKET_SIZE)
 
-				depth.head = len(tree) - 1
-			}
+		leaf := ChunkNode{}
+		leaf.start_idx = uint(start_idx)
+		leaf.end_idx   = uint(end_idx)
+		leaf.arr_len   = i8(end_idx - start_idx)
+		tree_push_node(tm, depth, 0, leaf)
+	}
+
+	for level := 0; level < depth.levels; level += 1 {
+		tree_fix_node(tm, depth, depth.spine[level])
+	}
+	depth.head = depth.spine[depth.levels - 1]
+}
+
+// Hangs a node off the right edge of the tree, growing a new root when the old one fills up
+tree_push_node :: proc(tm: ^Thread, depth: ^Depth, level: int, node: ChunkNode) {
+	idx := uint(len(depth.tree))
+	append(&depth.tree, node)
+
+	if level == depth.levels {
+		depth.spine[level] = idx
+		depth.levels += 1
+		return
+	}
+
+	// the old right edge won't get any more children, so this is the last time it needs work
+	prev := depth.spine[level]
+	tree_fix_node(tm, depth, prev)
+	depth.spine[level] = idx
+
+	if level + 1 == depth.levels {
+		if depth.levels == TREE_MAX_LEVELS {
+			push_fatal(SpallError.Bug)
 		}
+
+		root := ChunkNode{}
+		root.children[0] = prev
+		root.children[1] = idx
+		root.child_count = 2
+		tree_push_node(tm, depth, level + 1, root)
+		return
 	}
+
+	parent := &depth.tree[depth.spine[level + 1]]
+	if parent.child_count < CHUNK_NARY_WIDTH {
+		parent.children[parent.child_count] = idx
+		parent.child_count += 1
+		return
+	}
+
+	new_parent := ChunkNode{}
+	new_parent.children[0] = idx
+	new_parent.child_count = 1
+	tree_push_node(tm, depth, level + 1, new_parent)
 }
 
-generate_selftimes :: proc() {
-	for proc_v, p_idx in &processes {
-		for tm, t_idx in &proc_v.threads {
+// Recomputes a node's times and color from its events, or from its children
+tree_fix_node :: proc(tm: ^Thread, depth: ^Depth, idx: uint) {
+	node := &depth.tree[idx]
 
-			// skip the bottom rank, it's already set up correctly
-			if len(tm.depths) == 1 {
-				continue
-			}
+	if node.child_count == 0 {
+		scan_arr := depth.events[node.start_idx:node.end_idx]
+
+		start_ev := scan_arr[0]
+		end_ev := scan_arr[len(scan_arr)-1]
 
-			for depth, d_idx in &tm.depths {
-				// skip the last depth
-				if d_idx == (len(tm.depths) - 1) {
+		node.start_time = start_ev.timestamp - total_min_time
+		node.end_time   = end_ev.timestamp + bound_duration(end_ev, tm.max_time) - total_min_time
+
+		avg_color, weight := gen_event_color(scan_arr, tm.max_time)
+		node.avg_color = avg_color
+		node.weight = weight
+		return
+	}
+
+	start_node := depth.tree[node.children[0]]
+	end_node := depth.tree[node.children[node.child_count-1]]
+
+	node.start_time = start_node.start_time
+	node.end_time   = end_node.end_time
+	node.start_idx  = start_node.start_idx
+	node.end_idx    = end_node.end_idx
+
+	avg_color := FVec3{}
+	weight := 0.0
+	for i := 0; i < int(node.child_count); i += 1 {
+		child := depth.tree[node.children[i]]
+		avg_color += child.avg_color * f32(child.weight)
+		weight += child.weight
+	}
+	node.weight = weight
+	node.avg_color = avg_color / f32(weight)
+}
+
+// Makes everything parsed so far visible, while the rest of the trace is still coming in.
+// Big files show up a chunk at a time this way, and live traces never stop showing up.
+// Only depths that grew, or whose last event is (or just stopped being) open, get touched.
+progressive_refresh :: proc() {
+	if event_count == 0 {
+		return
+	}
+
+	if !shown_early {
+		generate_color_choices()
+	}
+
+	// node times are relative to total_min_time, so if that moved, every tree is stale
+	rebuild := total_min_time != tree_min_time
+	tree_min_time = total_min_time
+
+	for proc_v in &processes {
+		for tm in &proc_v.threads {
+			for depth in &tm.depths {
+				ev_count := len(depth.bs_events)
+				if ev_count == 0 {
 					continue
 				}
 
-				for ev, e_idx in &depth.events {
-					depth := tm.depths[d_idx+1]
-					tree := depth.tree
+				// an open event's end moves with the thread, and once it closes, the leaf needs one last redo
+				still_open := depth.bs_events[ev_count-1].duration < 0
+				if rebuild {
+					clear(&depth.tree)
+					depth.levels = 0
+				} else if !still_open && !depth.tail_open && ev_count == len(depth.events) {
+					continue
+				}
 
-					tree_stack := [128]uint{}
-					stack_len := 0
+				depth.events = depth.bs_events[:]
+				chunk_depth(&tm, &depth)
+				depth.tail_open = still_open
+			}
+		}
+	}
 
-					start_time := ev.timestamp - total_min_time
-					end_time := ev.timestamp + bound_duration(ev, tm.max_time) - total_min_time
+	if !shown_early {
+		shown_early = true
+		loading_config = false
+		post_loading = true
+	}
+}
 
-					child_time := 0.0
-					tree_stack[0] = depth.head; stack_len += 1
-					for stack_len > 0 {
-						stack_len -= 1
+generate_selftimes :: proc(tm: ^Thread) {
+	// skip the bottom rank, it's already set up correctly
+	if len(tm.depths) == 1 {
+		return
+	}
 
-						tree_idx := tree_stack[stack_len]
-						cur_node := tree[tree_idx]
+	for depth, d_idx in &tm.depths {
+		// skip the last depth
+		if d_idx == (len(tm.depths) - 1) {
+			continue
+		}
 
-						if end_time < cur_node.start_time || start_time > cur_node.end_time {
-							continue
-						}
+		for ev, e_idx in &depth.events {
+			depth := tm.depths[d_idx+1]
+			tree := depth.tree
 
-						if cur_node.start_time >= start_time && cur_node.end_time <= end_time {
-							child_time += cur_node.weight
-							continue
-						}
+			tree_stack := [128]uint{}
+			stack_len := 0
+
+			start_time := ev.timestamp - total_min_time
+			end_time := ev.timestamp + bound_duration(ev, tm.max_time) - total_min_time
+
+			child_time := 0.0
+			tree_stack[0] = depth.head; stack_len += 1
+			for stack_len > 0 {
+				stack_len -= 1
+
+				tree_idx := tree_stack[stack_len]
+				cur_node := tree[tree_idx]
 
-						if cur_node.child_count == 0 {
-							scan_arr := depth.events[cur_node.start_idx:cur_node.start_idx+uint(cur_node.arr_len)]
-							weight := 0.0
-							scan_loop: for scan_ev in scan_arr {
-								scan_ev_start_time := scan_ev.timestamp - total_min_time
-								if scan_ev_start_time < start_time {
-									continue
-								}
-
-								scan_ev_end_time := scan_ev.timestamp + bound_duration(scan_ev, tm.max_time) - total_min_time
-								if scan_ev_end_time > end_time {
-									break scan_loop
-								}
-
-								weight += bound_duration(scan_ev, tm.max_time)
-							}
-							child_time += weight
+				if end_time < cur_node.start_time || start_time > cur_node.end_time {
+					continue
+				}
+
+				if cur_node.start_time >= start_time && cur_node.end_time <= end_time {
+					child_time += cur_node.weight
+					continue
+				}
+
+				if cur_node.child_count == 0 {
+					scan_arr := depth.events[cur_node.start_idx:cur_node.start_idx+uint(cur_node.arr_len)]
+					weight := 0.0
+					scan_loop: for scan_ev in scan_arr {
+						scan_ev_start_time := scan_ev.timestamp - total_min_time
+						if scan_ev_start_time < start_time {
 							continue
 						}
 
-						for i := cur_node.child_count - 1; i >= 0; i -= 1 {
-							tree_stack[stack_len] = cur_node.children[i]; stack_len += 1
+						scan_ev_end_time := scan_ev.timestamp + bound_duration(scan_ev, tm.max_time) - total_min_time
+						if scan_ev_end_time > end_time {
+							break scan_loop
 						}
+
+						weight += bound_duration(scan_ev, tm.max_time)
 					}
+					child_time += weight
+					continue
+				}
 
-					ev.self_time = bound_duration(ev, tm.max_time) - child_time
+				for i := cur_node.child_count - 1; i >= 0; i -= 1 {
+					tree_stack[stack_len] = cur_node.children[i]; stack_len += 1
 				}
 			}
+
+			ev.self_time = bound_duration(ev, tm.max_time) - child_time
 		}
 	}
 }
 
 instant_count := 0
+mem_event_count := 0
 first_chunk: bool
 init_loading_state :: proc(size: u32, name: string) {
 	ingest_start_time = u64(get_time())
@@ -283,6 +490,12 @@ init_loading_state :: proc(size: u32, name: string) {
 	stats_state = .NoStats
 	total_tracked_time = 0.0
 	selected_event = EventID{-1, -1, -1, -1}
+	live_mode = false
+	live_trace = false
+	live_following = true
+	shown_early = false
+	tree_min_time = 0
+	pending_thread_count = 0
 
 	// wipe all allocators
 	free_all(scratch_allocator)
@@ -290,11 +503,16 @@ init_loading_state :: proc(size: u32, name: string) {
 	free_all(small_global_allocator)
 	free_all(big_global_allocator)
 	free_all(temp_allocator)
+	queue.init(&fps_history, 0, small_global_allocator)
 	processes = make([dynamic]Process, small_global_allocator)
 	process_map = vh_init(scratch_allocator)
+	sample_rates = vh_init(small_global_allocator)
+	clock_syncs = make([dynamic]ClockSync, small_global_allocator)
+	unaligned_pids = make([dynamic]u32, small_global_allocator)
 	global_instants = make([dynamic]Instant, big_global_allocator)
 	string_block = make([dynamic]u8, big_global_allocator)
 	stats = sm_init(big_global_allocator)
+	lock_stats = sm_init(big_global_allocator)
 	selected_ranges = make([dynamic]Range, 0, big_global_allocator)
 	total_max_time = 0
 	total_min_time = 0x7fefffffffffffff
@@ -303,6 +521,7 @@ init_loading_state :: proc(size: u32, name: string) {
 	first_chunk = true
 	event_count = 0
 	instant_count = 0
+	mem_event_count = 0
 
 	bp = init_parser(size)
 	
@@ -333,27 +552,34 @@ finish_loading :: proc () {
 	free_all(temp_allocator)
 	free_all(scratch_allocator)
 
-	generate_color_choices()
-
-	start_bench("generate spatial partitions")
-	chunk_events()
-	stop_bench("generate spatial partitions")
-
-	start_bench("generate self-time")
-	if is_json {
-		generate_selftimes()
+	if shown_early {
+		// processes and threads just got sorted, so anything picked while we were loading points at the wrong thing
+		clicked_on_rect = false
+		did_multiselect = false
+		stats_state = .NoStats
+		total_tracked_time = 0.0
+		selected_event = EventID{-1, -1, -1, -1}
+		clear(&selected_ranges)
+	} else {
+		generate_color_choices()
 	}
-	stop_bench("generate self-time")
+
+	// trees and self-times get built as threads come into view, see process_thread
+	queue_thread_processing()
 
 	t = 0
 	frame_count = 0
 
 	free_all(temp_allocator)
 	free_all(scratch_allocator)
-	queue.init(&fps_history, 0, small_global_allocator)
 
+	// everything under here lives as long as the trace does, whole-file stats get the rest
+	current_alloc_offset = big_global_arena.offset
+
+	// a live trace has had the user's camera on it for a while, don't yank it out from under them
 	loading_config = false
-	post_loading = true
+	post_loading = !(shown_early && live_trace)
+	shown_early = false
 
 	ingest_end_time := u64(get_time())
 	time_range := ingest_end_time - ingest_start_time
@@ -370,6 +596,11 @@ load_config_chunk :: proc "contextless" (chunk: []u8) {
 
 	if first_chunk {
 		header_sz := size_of(spall.Header)
+		if live_mode && len(chunk) < header_sz {
+			// the writer hasn't gotten the whole header out yet
+			get_chunk(0.0, f64(CHUNK_SIZE))
+			return
+		}
 		if len(chunk) < header_sz {
 			fmt.printf("Uh, you passed me an empty file?\n")
 			finish_loading()
@@ -378,6 +609,10 @@ load_config_chunk :: proc "contextless" (chunk: []u8) {
 		magic := (^u64)(raw_data(chunk))^
 
 		is_json = magic != spall.MAGIC
+		if is_json && live_mode {
+			fmt.printf("Live mode only takes binary traces\n")
+			push_fatal(SpallError.InvalidFile)
+		}
 		if is_json {
 			stamp_scale = 1
 			jp = init_json_parser()
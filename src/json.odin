@@ -685,6 +685,32 @@ process_event :: proc(ev: ^TempEvent) {
 				p_idx := setup_pid(ev.process_id)
 				processes[p_idx].name = name
 			}
+		} else if meta_str == "thread_sort_index" || meta_str == "process_sort_index" {
+			blob, err := json.parse_string(in_getstr(ev.args), json.DEFAULT_SPECIFICATION, false, scratch2_allocator)
+			if err != nil {
+				fmt.printf("Failed to parse args?\n")
+				push_fatal(SpallError.InvalidFile)
+			}
+
+			// integers come out as floats, we don't ask for them
+			arg_map, _ := blob.(json.Object)
+			m_sort_index, ok := arg_map["sort_index"].(json.Float)
+			if !ok {
+				fmt.printf("Invalid %s\n", meta_str)
+				push_fatal(SpallError.InvalidFile)
+			}
+
+			sort_index := i32(m_sort_index)
+			free_all(scratch2_allocator)
+
+			if meta_str == "thread_sort_index" {
+				p_idx := setup_pid(ev.process_id)
+				t_idx := setup_tid(p_idx, ev.thread_id)
+				processes[p_idx].threads[t_idx].sort_index = sort_index
+			} else {
+				p_idx := setup_pid(ev.process_id)
+				processes[p_idx].sort_index = sort_index
+			}
 		}
 	}
 }
@@ -926,8 +952,21 @@ json_push_event :: proc(process_id, thread_id: u32, event: ^JSONEvent) -> (int,
 	return p_idx, t_idx, len(t.json_events)-1
 }
 
-pid_sort_proc :: proc(a, b: Process) -> bool { return a.min_time < b.min_time }
-tid_sort_proc :: proc(a, b: Thread) -> bool  { return a.min_time < b.min_time }
+pid_sort_proc :: proc(a, b: Process) -> bool {
+	if a.sort_index != b.sort_index {
+		return a.sort_index < b.sort_index
+	}
+	return a.min_time < b.min_time
+}
+tid_sort_proc :: proc(a, b: Thread) -> bool {
+	if a.sort_index != b.sort_index {
+		return a.sort_index < b.sort_index
+	}
+	if a.is_fiber != b.is_fiber {
+		return !a.is_fiber
+	}
+	return a.min_time < b.min_time
+}
 instant_rendersort_proc :: proc(a, b: Instant) -> bool {
 	return a.timestamp < b.timestamp
 }
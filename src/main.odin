@@ -73,6 +73,19 @@ selected_ranges: [dynamic]Range
 cur_stat_offset := StatOffset{}
 total_tracked_time := 0.0
 
+// lock waits from spall_auto.h all share a zone name, with the lock in their args,
+// so they get a second set of stats keyed on the (interned) args to break them out per lock
+LOCK_ARGS_PREFIX :: `{"lock":"`
+lock_stats: StatMap
+stats_per_lock := false
+
+// name.start -> sample rate, for names that only got every Nth instance written
+sample_rates: ValHash
+// every clock sync we've read, applied once the whole trace is in
+clock_syncs: [dynamic]ClockSync
+// pids that had syncs to line up against but none of their own, still on their own clock
+unaligned_pids: [dynamic]u32
+
 
 // drawing state
 default_font   := `'Montserrat',-apple-system,BlinkMacSystemFont,segoe ui,Helvetica,Arial,sans-serif,apple color emoji,segoe ui emoji,segoe ui symbol`
@@ -129,6 +142,16 @@ event_count: i64
 bp: Parser
 last_read: i64
 
+// the trace is up on screen before it's done loading
+shown_early := false
+// total_min_time the trees were last built against
+tree_min_time: f64
+
+// live mode: the trace is still being written, and a relay hands it to us as it grows
+live_mode := false
+live_trace := false
+live_following := true
+
 string_block: [dynamic]u8
 processes: [dynamic]Process
 process_map: ValHash
@@ -337,6 +360,9 @@ render_widetree :: proc(p_idx, t_idx: int, start_x: f64, scale: f64, layer_count
 	thread := &processes[p_idx].threads[t_idx]
 	depth := thread.depths[0]
 	tree := depth.tree
+	if len(tree) == 0 {
+		return
+	}
 
 	// If we blow this, we're in space
 	tree_stack := [128]uint{}
@@ -426,9 +452,9 @@ render_minitree :: proc(pid, tid: int, depth_idx: int, start_x: f64, scale: f64)
 	depth := thread.depths[depth_idx]
 	tree := depth.tree
 
+	// depth-tagged events can leave gaps in the depths above them
 	if len(tree) == 0 {
-		fmt.printf("depth_idx: %d, depth count: %d, %v\n", depth_idx, len(thread.depths), thread.depths)
-		push_fatal(SpallError.Bug)
+		return
 	}
 
 	found_rid := -1
@@ -529,7 +555,7 @@ render_minievents :: proc(scan_arr: []Event, thread_max_time: f64, start_x: f64,
 		r_x    = max(r_x, 0)
 		r_w   := end_x - r_x
 
-		idx := name_color_idx(in_getstr(ev.name))
+		idx := name_color_idx(ev.name)
 		rect_color := color_choices[idx]
 		e_idx := int(start_idx) + de_id
 
@@ -558,10 +584,246 @@ render_minievents :: proc(scan_arr: []Event, thread_max_time: f64, start_x: f64,
 	}
 }
 
+// Instants get a thin line down their thread, and a label if there's room before the next one
+render_instants :: proc(tm: ^Thread, y_start, height: f64, start_time, end_time: f64) {
+	instants := tm.instants[:]
+	if len(instants) == 0 {
+		return
+	}
+
+	// they're sorted, so skip straight to the first one on screen
+	lo, hi := 0, len(instants)
+	for lo < hi {
+		mid := (lo + hi) / 2
+		if instants[mid].timestamp - total_min_time < start_time {
+			lo = mid + 1
+		} else {
+			hi = mid
+		}
+	}
+
+	color := [4]u8{u8(instant_color.x), u8(instant_color.y), u8(instant_color.z), u8(instant_color.w)}
+	for i := lo; i < len(instants); i += 1 {
+		x := instants[i].timestamp - total_min_time
+		if x > end_time {
+			break
+		}
+
+		r_x := (x * cam.current_scale) + cam.pan.x + disp_rect.pos.x
+		append(&gl_rects, DrawRect{f32(r_x), 2, color})
+
+		name := in_getstr(instants[i].name)
+		text_width := measure_text(name, p_font_size, default_font)
+		next_x : f64 = 0x7fefffffffffffff
+		if i + 1 < len(instants) {
+			next_x = ((instants[i+1].timestamp - total_min_time) * cam.current_scale) + cam.pan.x + disp_rect.pos.x
+		}
+		if next_x - r_x > text_width + 8 {
+			draw_text(name, Vec2{r_x + 4, y_start}, p_font_size, default_font, text_color)
+		}
+	}
+
+	gl_push_rects(gl_rects[:], y_start, height)
+	resize(&gl_rects, 0)
+}
+
+// A fiber's time off its threads gets washed out, so it reads as a gap, even under zones it left open
+render_suspends :: proc(tm: ^Thread, y_start, height: f64, start_time, end_time: f64) {
+	suspends := tm.suspends[:]
+
+	// they don't overlap, so the ends are sorted too
+	lo, hi := 0, len(suspends)
+	for lo < hi {
+		mid := (lo + hi) / 2
+		if suspends[mid].end - total_min_time < start_time {
+			lo = mid + 1
+		} else {
+			hi = mid
+		}
+	}
+
+	color := [4]u8{u8(bg_color.x), u8(bg_color.y), u8(bg_color.z), 200}
+	for suspend in suspends[lo:] {
+		if suspend.start - total_min_time > end_time {
+			break
+		}
+
+		start := max(suspend.start - total_min_time, start_time)
+		end := min(suspend.end - total_min_time, end_time)
+		if end <= start {
+			continue
+		}
+
+		r_x := (start * cam.current_scale) + cam.pan.x + disp_rect.pos.x
+		r_w := (end - start) * cam.current_scale
+		append(&gl_rects, DrawRect{f32(r_x), f32(r_w), color})
+	}
+
+	gl_push_rects(gl_rects[:], y_start, height)
+	resize(&gl_rects, 0)
+}
+
+// index of the first one at or after time
+mem_event_find :: proc(events: []MemEvent, time: f64) -> int {
+	lo, hi := 0, len(events)
+	for lo < hi {
+		mid := (lo + hi) / 2
+		if events[mid].timestamp < time {
+			lo = mid + 1
+		} else {
+			hi = mid
+		}
+	}
+	return lo
+}
+
+// Bytes the thread allocated between start and end, off of the running totals
+mem_allocated_between :: proc(tm: ^Thread, start, end: f64) -> u64 {
+	events := tm.mem_events[:]
+	if len(events) == 0 {
+		return 0
+	}
+
+	start_idx := mem_event_find(events, start)
+	end_idx := mem_event_find(events, end)
+	if end_idx == 0 {
+		return 0
+	}
+
+	before: u64 = 0
+	if start_idx > 0 {
+		before = events[start_idx - 1].allocated
+	}
+	return events[end_idx - 1].allocated - before
+}
+
+stat_add :: proc(m: ^StatMap, key: INStr, duration, self_time: f64, allocated: u64, rate: int) {
+	s, ok := sm_get(m, key)
+	if !ok {
+		s = sm_insert(m, key, Stats{min_time = 1e308})
+	}
+	s.count += u32(rate)
+	s.total_time += duration * f64(rate)
+	s.self_time += self_time * f64(rate)
+	s.min_time = min(s.min_time, duration)
+	s.max_time = max(s.max_time, duration)
+	s.allocated += allocated * u64(rate)
+}
+
+// The lock out of a lock wait's args, {"lock":"<lock>"}
+lock_label :: proc(args: INStr) -> (string, bool) {
+	str := in_getstr(args)
+	if !strings.has_prefix(str, LOCK_ARGS_PREFIX) || !strings.has_suffix(str, `"}`) || len(str) < len(LOCK_ARGS_PREFIX) + 2 {
+		return "", false
+	}
+	return str[len(LOCK_ARGS_PREFIX):len(str) - 2], true
+}
+
+// Finds the event one depth up that ev sits inside, if the selection picked it up too
+stat_parent_name :: proc(range: Range, ev: Event) -> (INStr, bool) {
+	thread := processes[range.pid].threads[range.tid]
+	parents := thread.depths[range.did - 1].events
+	if len(parents) == 0 {
+		return {}, false
+	}
+
+	p_idx := find_idx(parents, ev.timestamp - total_min_time)
+	parent := parents[p_idx]
+	if parent.timestamp > ev.timestamp || parent.timestamp + bound_duration(parent, thread.max_time) < ev.timestamp {
+		return {}, false
+	}
+
+	for r in selected_ranges {
+		if r.pid == range.pid && r.tid == range.tid && r.did == range.did - 1 && p_idx >= r.start && p_idx < r.end {
+			return parent.name, true
+		}
+	}
+	return {}, false
+}
+
+MEM_TRACK_BANDS :: 8
+
+// processes with heap traffic get a live bytes track above their threads, two rects tall
+mem_track_height :: proc(p: Process) -> f64 {
+	if len(p.live_bytes) == 0 {
+		return 0
+	}
+	return h2_height + (h2_height / 2) + (2 * rect_height) + thread_gap
+}
+
+// The live bytes counter gets sampled every couple of pixels, and stacked up in bands,
+// so each band goes out as one row of rects like everything else
+render_mem_track :: proc(p: ^Process, y_start: f64, start_time, end_time: f64) {
+	samples := p.live_bytes[:]
+	if len(samples) == 0 {
+		return
+	}
+
+	if y_start > disp_rect.pos.y {
+		draw_text(fmt.tprintf("Heap (peak %s)", bytes_fmt(f64(p.max_live_bytes))), Vec2{disp_rect.pos.x + 5, y_start}, h2_font_size, default_font, text_color)
+	}
+	if p.max_live_bytes <= 0 {
+		return
+	}
+
+	band_top := y_start + h2_height + (h2_height / 2)
+	band_height := (2 * rect_height) / MEM_TRACK_BANDS
+
+	COLUMN_WIDTH :: 2.0
+	columns := int(((end_time - start_time) * cam.current_scale) / COLUMN_WIDTH) + 1
+	levels := make([]u8, columns, context.temp_allocator)
+
+	last_time := samples[len(samples) - 1].timestamp - total_min_time
+	for i := 0; i < columns; i += 1 {
+		t := start_time + ((f64(i) * COLUMN_WIDTH) / cam.current_scale)
+		if t > last_time {
+			break
+		}
+
+		// the counter holds whatever the last change before t left it at
+		lo, hi := 0, len(samples)
+		for lo < hi {
+			mid := (lo + hi) / 2
+			if samples[mid].timestamp - total_min_time <= t {
+				lo = mid + 1
+			} else {
+				hi = mid
+			}
+		}
+		if lo == 0 {
+			continue
+		}
+
+		frac := f64(samples[lo - 1].live_bytes) / f64(p.max_live_bytes)
+		levels[i] = u8(math.ceil(frac * MEM_TRACK_BANDS))
+	}
+
+	start_x := (start_time * cam.current_scale) + cam.pan.x + disp_rect.pos.x
+	color := [4]u8{u8(mem_color.x), u8(mem_color.y), u8(mem_color.z), u8(mem_color.w)}
+	for band := 1; band <= MEM_TRACK_BANDS; band += 1 {
+		run_start := -1
+		for i := 0; i <= columns; i += 1 {
+			filled := i < columns && int(levels[i]) >= band
+			if filled && run_start == -1 {
+				run_start = i
+			} else if !filled && run_start != -1 {
+				append(&gl_rects, DrawRect{f32(start_x + (f64(run_start) * COLUMN_WIDTH)), f32(f64(i - run_start) * COLUMN_WIDTH), color})
+				run_start = -1
+			}
+		}
+
+		gl_push_rects(gl_rects[:], band_top + (f64(MEM_TRACK_BANDS - band) * band_height), band_height)
+		resize(&gl_rects, 0)
+	}
+}
+
 render_tree :: proc(pid, tid, depth_idx: int, y_start: f64, start_time, end_time: f64) {
 	thread := processes[pid].threads[tid]
 	depth := thread.depths[depth_idx]
 	tree := depth.tree
+	if len(tree) == 0 {
+		return
+	}
 
 	found_rid := -1
 	range_loop: for range, r_idx in selected_ranges {
@@ -686,7 +948,7 @@ render_events :: proc(p_idx, t_idx, d_idx: int, events: []Event, start_idx: uint
 		}
 
 		ev_name := in_getstr(ev.name)
-		idx := name_color_idx(ev_name)
+		idx := name_color_idx(ev.name)
 		rect_color := color_choices[idx]
 		e_idx := int(start_idx) + de_id
 
@@ -888,8 +1150,6 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 	if post_loading {
 		reset_camera(display_width)
-		arena := cast(^Arena)context.allocator.data
-		current_alloc_offset = arena.offset
 		post_loading = false
 	}
 
@@ -951,6 +1211,7 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 					h1_size := h1_height + (h1_height / 2)
 					cur_y += h1_size
 				}
+				cur_y += mem_track_height(proc_v)
 
 				for tm, _ in proc_v.threads {
 					h2_size := h2_height + (h2_height / 2)
@@ -1016,6 +1277,18 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 			}
 		}
 
+		// live traces grow to the right, so stick to the newest events until the user pans or zooms away from them
+		if live_mode {
+			trace_width := (total_max_time - total_min_time) * cam.target_scale
+			follow_pan_x := min(display_width - (2 * em) - trace_width, 2 * em)
+			if is_mouse_down || cam.target_scale != old_scale {
+				live_following = cam.target_pan_x <= follow_pan_x + em
+			} else if live_following {
+				cam.target_pan_x = follow_pan_x
+				cam.vel.x = 0
+			}
+		}
+
 		cam.target_pan_x = cam.target_pan_x + (cam.vel.x * dt)
 		cam.pan.y = cam.pan.y + (cam.vel.y * dt)
 		cam.vel *= _pow(0.0001, dt)
@@ -1116,6 +1389,13 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 				cur_y += h1_size
 			}
 
+			if mem_height := mem_track_height(proc_v); mem_height > 0 {
+				if cur_y + mem_height > 0 && cur_y < info_pane_y {
+					render_mem_track(&proc_v, cur_y, start_time, end_time)
+				}
+				cur_y += mem_height
+			}
+
 			thread_loop: for tm, t_idx in &proc_v.threads {
 				last_cur_y := cur_y
 				h2_size := h2_height + (h2_height / 2)
@@ -1133,7 +1413,9 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 				if last_cur_y > disp_rect.pos.y {
 					row_text: string
-					if tm.name.len > 0 {
+					if tm.is_fiber {
+						row_text = fmt.tprintf("Fiber: %d", tm.thread_id)
+					} else if tm.name.len > 0 {
 						row_text = fmt.tprintf("%s (TID %d)", in_getstr(tm.name), tm.thread_id)
 					} else {
 						row_text = fmt.tprintf("TID: %d", tm.thread_id)
@@ -1141,6 +1423,7 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 					draw_text(row_text, Vec2{start_x + 5, last_cur_y}, h2_font_size, default_font, text_color)
 				}
 
+				process_thread(&tm)
 				cur_depth_off := 0
 				for depth, d_idx in &tm.depths {
 					render_tree(p_idx, t_idx, d_idx, cur_y, start_time, end_time)
@@ -1148,6 +1431,8 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 					resize(&gl_rects, 0)
 				}
+				render_instants(&tm, cur_y, max(f64(len(tm.depths)), 1) * rect_height, start_time, end_time)
+				render_suspends(&tm, cur_y, max(f64(len(tm.depths)), 1) * rect_height, start_time, end_time)
 				cur_y += thread_advance
 			}
 		}
@@ -1221,13 +1506,19 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 		tree_y : f64 = padded_graph_rect.pos.y - (cam.pan.y * y_scale)
 		for proc_v, p_idx in &processes {
 			for tm, t_idx in &proc_v.threads {
+				// the minimap shows a few screens' worth of threads, so anything in it gets built now, not when it scrolls into the graph
+				thread_height := f64(len(tm.depths)) * mini_rect_height
+				if tree_y + thread_height >= start_y && tree_y <= end_y {
+					process_thread(&tm)
+				}
+
 				for depth, d_idx in &tm.depths {
 					render_minitree(p_idx, t_idx, d_idx, mini_start_x + mini_graph_pad, x_scale)
 					gl_push_rects(gl_rects[:], (tree_y + (mini_rect_height * f64(d_idx))), mini_rect_height)
 					resize(&gl_rects, 0)
 				}
 
-				tree_y += ((f64(len(tm.depths)) * mini_rect_height) + mini_thread_gap)
+				tree_y += thread_height + mini_thread_gap
 			}
 		}
 
@@ -1427,6 +1718,7 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 			resize(&selected_ranges, 0)
 			sm_clear(&stats)
+			sm_clear(&lock_stats)
 
 			// build out ranges
 			cur_y := padded_graph_rect.pos.y - cam.pan.y
@@ -1436,6 +1728,7 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 					h1_size = h1_height + (h1_height / 2)
 					cur_y += h1_size
 				}
+				cur_y += mem_track_height(proc_v)
 
 				for tm, t_idx in proc_v.threads {
 					h2_size := h2_height + (h2_height / 2)
@@ -1537,6 +1830,7 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 					start_idx = max(start_idx, cur_stat_offset.event_idx)
 				}
 
+				process_thread(&processes[range.pid].threads[range.tid])
 				thread := processes[range.pid].threads[range.tid]
 				events := thread.depths[range.did].events[start_idx:range.end]
 
@@ -1549,31 +1843,48 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 					duration := bound_duration(ev, thread.max_time)
 
-					s, ok := sm_get(&stats, ev.name)
-					if !ok {
-						s = sm_insert(&stats, ev.name, Stats{min_time = 1e308})
+					// a sampled event stands in for rate events, so scale the totals back up
+					rate := sample_rate_of(ev.name)
+
+					allocated: u64 = 0
+					if len(thread.mem_events) > 0 {
+						allocated = mem_allocated_between(&thread, ev.timestamp, ev.timestamp + duration)
+					}
+					stat_add(&stats, ev.name, duration, ev.self_time, allocated, rate)
+					if _, is_lock := lock_label(ev.args); is_lock {
+						stat_add(&lock_stats, ev.args, duration, ev.self_time, allocated, rate)
+					}
+					total_tracked_time += duration * f64(rate)
+
+					// the parent's self time only lost the one instance we kept, so take the rest out of its stats too
+					if rate > 1 && range.did > 0 {
+						if parent_name, found := stat_parent_name(range, ev); found {
+							ps, ok := sm_get(&stats, parent_name)
+							if !ok {
+								ps = sm_insert(&stats, parent_name, Stats{min_time = 1e308})
+							}
+							ps.self_time -= duration * f64(rate - 1)
+						}
 					}
-					s.count += 1
-					s.total_time += duration
-					s.self_time += ev.self_time
-					s.min_time = min(s.min_time, duration)
-					s.max_time = max(s.max_time, duration)
-					total_tracked_time += duration
 
 					event_count += 1
 				}
 			}
 
 			if !broke_early {
-				for i := 0; i < len(stats.entries); i += 1 {
-					entry := &stats.entries[i]
-					entry.val.avg_time = entry.val.total_time / f64(entry.val.count)
+				for m in ([]^StatMap{&stats, &lock_stats}) {
+					for i := 0; i < len(m.entries); i += 1 {
+						entry := &m.entries[i]
+						entry.val.avg_time = entry.val.total_time / f64(entry.val.count)
+						entry.val.self_time = max(entry.val.self_time, 0)
+					}
 				}
 
 				self_sort :: proc(a, b: StatEntry) -> bool {
 					return a.val.self_time > b.val.self_time
 				}
 				sm_sort(&stats, self_sort)
+				sm_sort(&lock_stats, self_sort)
 				stats_state = .Finished
 			}
 		}
@@ -1596,6 +1907,10 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 			draw_text(fmt.tprintf("start time:%s", time_fmt(event.timestamp - total_min_time)), Vec2{x_subpad, next_line(&y, em)}, p_font_size, monospace_font, text_color)
 			draw_text(fmt.tprintf("  duration:%s", time_fmt(bound_duration(event, thread.max_time))), Vec2{x_subpad, next_line(&y, em)}, p_font_size, monospace_font, text_color)
 			draw_text(fmt.tprintf(" self time:%s", time_fmt(event.self_time)), Vec2{x_subpad, next_line(&y, em)}, p_font_size, monospace_font, text_color)
+			if len(thread.mem_events) > 0 {
+				allocated := mem_allocated_between(&thread, event.timestamp, event.timestamp + bound_duration(event, thread.max_time))
+				draw_text(fmt.tprintf(" allocated: %s", bytes_fmt(f64(allocated))), Vec2{x_subpad, next_line(&y, em)}, p_font_size, monospace_font, text_color)
+			}
 
 		// If we've got stats cooking already
 		} else if stats_state == .Started {
@@ -1661,11 +1976,15 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 			full_time := total_max_time - total_min_time
 
+			// only offer the per lock view when the selection actually has lock waits in it
+			per_lock := stats_per_lock && len(lock_stats.entries) > 0
+			shown := per_lock ? &lock_stats : &stats
+
 			y += header_height + (em / 4)
 
 			displayed_lines := info_line_count - 1
-			if displayed_lines < len(stats.entries) {
-				max_lines := len(stats.entries)
+			if displayed_lines < len(shown.entries) {
+				max_lines := len(shown.entries)
 
 				// goofy hack to get line height
 				tmp := y
@@ -1679,8 +1998,8 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 			stat_idx := 0
 			last_pos := 0.0
-			stat_loop: for i := 0; i < len(stats.entries); i += 1 {
-				entry := stats.entries[i]
+			stat_loop: for i := 0; i < len(shown.entries); i += 1 {
+				entry := shown.entries[i]
 				name := entry.key
 				stat := entry.val
 
@@ -1721,6 +2040,10 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 				text_outf(&cursor, y, min_text, text_color2);   cursor += column_gap
 				text_outf(&cursor, y, avg_text, text_color2);   cursor += column_gap
 				text_outf(&cursor, y, max_text, text_color2);   cursor += column_gap
+				if mem_event_count > 0 {
+					alloc_text := fmt.tprintf("%10s", bytes_fmt(f64(stat.allocated)))
+					text_outf(&cursor, y, alloc_text, text_color2); cursor += column_gap
+				}
 
 				y_before   := y - (em / 2)
 				y_after    := y_before
@@ -1732,7 +2055,10 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 
 				//name_width := measure_text(name, p_font_size, monospace_font)
 				name_str := in_getstr(name)
-				tmp_color := color_choices[name_color_idx(name_str)]
+				if per_lock {
+					name_str, _ = lock_label(name)
+				}
+				tmp_color := color_choices[name_color_idx(name)]
 				draw_rect(dr, FVec4{tmp_color.x, tmp_color.y, tmp_color.z, 255})
 				draw_text(name_str, Vec2{cursor, y_before + (em / 3)}, p_font_size, monospace_font, text_color)
 
@@ -1794,8 +2120,29 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 			max_header_text    := fmt.tprintf("%-10s", "   max.")
 			column_header(&cursor, column_gap, y, info_pane_y, info_pane_height, max_header_text, .MaxTime)
 
-			name_header_text   := fmt.tprintf("%-10s", "   name")
+			if mem_event_count > 0 {
+				alloc_header_text := fmt.tprintf("%-10s", "  alloc.")
+				column_header(&cursor, column_gap, y, info_pane_y, info_pane_height, alloc_header_text, .Allocated)
+			}
+
+			name_header_text   := fmt.tprintf("%-10s", per_lock ? "   lock" : "   name")
 			text_outf(&cursor, y, name_header_text, text_color)
+
+			if len(lock_stats.entries) > 0 {
+				cursor += column_gap
+				toggle_text := per_lock ? "(show per name)" : "(show per lock)"
+				toggle_rect := rect(cursor, info_pane_y, measure_text(toggle_text, p_font_size, monospace_font), 2 * em)
+				text_outf(&cursor, y, toggle_text, text_color2)
+
+				if pt_in_rect(mouse_pos, toggle_rect) {
+					set_cursor("pointer")
+				}
+				if clicked && pt_in_rect(clicked_pos, toggle_rect) {
+					stats_per_lock = !per_lock
+					info_pane_scroll = 0
+					info_pane_scroll_vel = 0
+				}
+			}
 		} else {
 			y := height - em - top_line_gap
 
@@ -1847,8 +2194,17 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 					return a.val.max_time < b.val.max_time
 				}
 			}
+		case .Allocated:
+			less = proc(a, b: StatEntry) -> bool {
+				if stat_sort_descending {
+					return a.val.allocated > b.val.allocated
+				} else {
+					return a.val.allocated < b.val.allocated
+				}
+			}
 		}
 		sm_sort(&stats, less)
+		sm_sort(&lock_stats, less)
 		resort_stats = false
 	}
 
@@ -1883,7 +2239,8 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 		cursor_x += button_width + button_pad
 
 		// Process All Events
-		if button(rect(cursor_x, (toolbar_height / 2) - (button_height / 2), button_width, button_height), "\uf1fe", "get stats for the whole file", icon_font, 0, width) {
+		// (not while events are still coming in, the arena past current_alloc_offset is still in use)
+		if button(rect(cursor_x, (toolbar_height / 2) - (button_height / 2), button_width, button_height), "\uf1fe", "get stats for the whole file", icon_font, 0, width) && !(live_mode || shown_early) {
 			stats_state = .Started
 			did_multiselect = true
 			total_tracked_time = 0.0
@@ -1895,6 +2252,7 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 			big_global_arena.offset = current_alloc_offset
 			resize(&selected_ranges, 0)
 			sm_clear(&stats)
+			sm_clear(&lock_stats)
 
 			for proc_v, p_idx in processes {
 				for tm, t_idx in proc_v.threads {
@@ -1906,9 +2264,45 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 		}
 		cursor_x += button_width + button_pad
 
-		file_name_width := measure_text(file_name, h1_font_size, default_font)
+		// Save Snapshot
+		if !live_trace {
+			if button(rect(cursor_x, (toolbar_height / 2) - (button_height / 2), button_width, button_height), "\uf019", "download a snapshot, for reopening quickly", icon_font, 0, width) {
+				save_snapshot(true)
+			}
+			cursor_x += button_width + button_pad
+		}
+
+		title := file_name
+		if live_mode {
+			title = fmt.tprintf("%s (live)", file_name)
+		} else if shown_early {
+			title = fmt.tprintf("%s (loading, %d%%)", file_name, bp.pos * 100 / max(i64(bp.total_size), 1))
+		}
+
+		file_name_width := measure_text(title, h1_font_size, default_font)
 		name_x := max((display_width / 2) - (file_name_width / 2), cursor_x)
-		draw_text(file_name, Vec2{name_x, (toolbar_height / 2) - (h1_height / 2)}, h1_font_size, default_font, toolbar_text_color)
+		draw_text(title, Vec2{name_x, (toolbar_height / 2) - (h1_height / 2)}, h1_font_size, default_font, toolbar_text_color)
+
+		// pids the clock syncs couldn't line up can be way off from everything else, so say which
+		if len(unaligned_pids) > 0 {
+			b := strings.builder_make(context.temp_allocator)
+			strings.write_string(&b, "clocks not aligned for pid")
+			if len(unaligned_pids) > 1 {
+				strings.write_string(&b, "s")
+			}
+			for pid, i in unaligned_pids {
+				fmt.sbprintf(&b, i == 0 ? " %d" : ", %d", pid)
+			}
+			warn_text := strings.to_string(b)
+
+			warn_x := name_x + file_name_width + em
+			warn_icon_width := measure_text("\uf071", p_font_size, icon_font)
+			warn_rect := rect(warn_x, (toolbar_height / 2) - (button_height / 2), warn_icon_width, button_height)
+			draw_text("\uf071", Vec2{warn_x, (toolbar_height / 2) - (p_height / 2)}, p_font_size, icon_font, toolbar_text_color)
+			if pt_in_rect(mouse_pos, warn_rect) {
+				tooltip(Vec2{warn_x, warn_rect.pos.y + warn_rect.size.y + em}, 0, width, warn_text)
+			}
+		}
 
 		// colormode button nonsense
 		color_text : string
@@ -2059,6 +2453,12 @@ frame :: proc "contextless" (width, height: f64, _dt: f64) -> bool {
 		}
 	}
 
+	// chip away at the threads nobody's looked at yet
+	if pending_thread_count > 0 {
+		process_idle_threads(IDLE_PROCESS_MS)
+		render_one_more = true
+	}
+
 	// save me my battery, plz
 	PAN_X_EPSILON :: 0.01
 	PAN_Y_EPSILON :: 1.0
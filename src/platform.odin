@@ -154,6 +154,9 @@ foreign js {
 
 	get_chunk :: proc(offset, size: f64) ---
 	open_file_dialog :: proc() ---
+
+	trace_loaded :: proc() ---
+	_store_snapshot :: proc(data: rawptr, size: int, download: bool, name: string) ---
 }
 
 // a bunch of silly platform wrappers, so I can jam in dpr scaling
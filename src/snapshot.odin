@@ -0,0 +1,387 @@
+package main
+
+import "core:fmt"
+import "core:mem"
+import "core:intrinsics"
+import "core:runtime"
+
+// A snapshot is everything a trace leaves behind once it's done loading (sorted events, trees, self-times),
+// packed into one relocatable image. Reopening is then a bulk copy into the big arena, and a pass to point
+// the arrays back into it, instead of the whole parse/sort/chunk pipeline.
+// They hold our structs as-is, so they're only good for the build that wrote them.
+
+SNAPSHOT_MAGIC   :: 0x504E534C4C415053 // "SPALLSNP"
+SNAPSHOT_VERSION :: 1
+SNAPSHOT_MAX_SIZE :: 0x7FFF_FFFF
+SNAPSHOT_MAX_PAGES :: 65536 // the memory maximum spall.js hands us
+
+// where an array lives in the image, offsets are from the start of it
+SnapSlice :: struct #packed {
+	offset: u64,
+	len: u64,
+}
+
+SnapHeader :: struct #packed {
+	magic: u64,
+	version: u32,
+	build_hash: i64,
+	size: u64,
+
+	is_json: bool,
+	total_min_time: f64,
+	total_max_time: f64,
+	event_count: i64,
+	instant_count: i64,
+	mem_event_count: i64,
+
+	// tree nodes have their colors baked in, so the events need the same palette
+	color_choices: [choice_count]FVec3,
+
+	string_block: SnapSlice,
+	global_instants: SnapSlice,
+	sample_rates: SnapSlice,
+	unaligned_pids: SnapSlice,
+	processes: SnapSlice,
+}
+
+SnapProcess :: struct #packed {
+	min_time: f64,
+	name: INStr,
+	sort_index: i32,
+	process_id: u32,
+	max_live_bytes: i64,
+
+	threads: SnapSlice,
+	instants: SnapSlice,
+	live_bytes: SnapSlice,
+}
+
+SnapThread :: struct #packed {
+	min_time: f64,
+	max_time: f64,
+	thread_id: u32,
+	name: INStr,
+	sort_index: i32,
+	is_fiber: bool,
+
+	depths: SnapSlice,
+	instants: SnapSlice,
+	mem_events: SnapSlice,
+	suspends: SnapSlice,
+}
+
+SnapDepth :: struct #packed {
+	head: uint,
+	spine: [TREE_MAX_LEVELS]uint,
+	levels: int,
+
+	tree: SnapSlice,
+	events: SnapSlice,
+}
+
+SnapWriter :: struct {
+	buf: []u8, // nil while we're just sizing things up
+	pos: u64,
+}
+
+snap_push :: proc(w: ^SnapWriter, data: []$T) -> SnapSlice {
+	w.pos = (w.pos + 7) & ~u64(7)
+	s := SnapSlice{offset = w.pos, len = u64(len(data))}
+
+	size := len(data) * size_of(T)
+	if w.buf != nil && size > 0 {
+		mem.copy(&w.buf[int(w.pos)], raw_data(data), size)
+	}
+	w.pos += u64(size)
+	return s
+}
+
+// Runs twice, once with no buffer to get the size, and once for real, so it has to do the same thing both times
+snapshot_write :: proc(w: ^SnapWriter) {
+	hdr := SnapHeader{
+		magic = SNAPSHOT_MAGIC,
+		version = SNAPSHOT_VERSION,
+		build_hash = i64(build_hash),
+		is_json = is_json,
+		total_min_time = total_min_time,
+		total_max_time = total_max_time,
+		event_count = event_count,
+		instant_count = i64(instant_count),
+		mem_event_count = i64(mem_event_count),
+		color_choices = color_choices,
+	}
+	w.pos = size_of(SnapHeader)
+
+	hdr.string_block = snap_push(w, string_block[:])
+	hdr.global_instants = snap_push(w, global_instants[:])
+	hdr.sample_rates = snap_push(w, sample_rates.entries[:])
+	hdr.unaligned_pids = snap_push(w, unaligned_pids[:])
+
+	// the records only have to live until they're pushed, so each level hands its scratch space back when it's done
+	scratch_start := scratch_arena.offset
+	defer scratch_arena.offset = scratch_start
+
+	snap_procs := make([]SnapProcess, len(processes), scratch_allocator)
+	for proc_v, p_idx in &processes {
+		threads_start := scratch_arena.offset
+		snap_threads := make([]SnapThread, len(proc_v.threads), scratch_allocator)
+		for tm, t_idx in &proc_v.threads {
+			depths_start := scratch_arena.offset
+			snap_depths := make([]SnapDepth, len(tm.depths), scratch_allocator)
+			for depth, d_idx in &tm.depths {
+				snap_depths[d_idx] = SnapDepth{
+					head = depth.head,
+					spine = depth.spine,
+					levels = depth.levels,
+					tree = snap_push(w, depth.tree[:]),
+					events = snap_push(w, depth.events),
+				}
+			}
+
+			snap_threads[t_idx] = SnapThread{
+				min_time = tm.min_time,
+				max_time = tm.max_time,
+				thread_id = tm.thread_id,
+				name = tm.name,
+				sort_index = tm.sort_index,
+				is_fiber = tm.is_fiber,
+				depths = snap_push(w, snap_depths),
+				instants = snap_push(w, tm.instants[:]),
+				mem_events = snap_push(w, tm.mem_events[:]),
+				suspends = snap_push(w, tm.suspends[:]),
+			}
+			scratch_arena.offset = depths_start
+		}
+
+		snap_procs[p_idx] = SnapProcess{
+			min_time = proc_v.min_time,
+			name = proc_v.name,
+			sort_index = proc_v.sort_index,
+			process_id = proc_v.process_id,
+			max_live_bytes = proc_v.max_live_bytes,
+			threads = snap_push(w, snap_threads),
+			instants = snap_push(w, proc_v.instants[:]),
+			live_bytes = snap_push(w, proc_v.live_bytes[:]),
+		}
+		scratch_arena.offset = threads_start
+	}
+	hdr.processes = snap_push(w, snap_procs)
+
+	hdr.size = w.pos
+	if w.buf != nil {
+		(^SnapHeader)(raw_data(w.buf))^ = hdr
+	}
+}
+
+// The image gets built at the end of the big arena, so it has to fit in what's left of wasm memory
+snapshot_fits :: proc(size: u64) -> bool {
+	arena_left := u64(len(big_global_arena.data) - big_global_arena.offset)
+	pages_left := u64(SNAPSHOT_MAX_PAGES) - u64(intrinsics.wasm_memory_size(0))
+	return size <= SNAPSHOT_MAX_SIZE && size <= arena_left + (pages_left * PAGE_SIZE)
+}
+
+// Hands the loaded trace over to spall.js as a snapshot, to cache (or download, if asked to)
+@export
+save_snapshot :: proc "contextless" (download: bool) {
+	context = wasmContext
+
+	if loading_config || live_trace || event_count == 0 {
+		return
+	}
+	process_all_threads()
+
+	sizer := SnapWriter{}
+	snapshot_write(&sizer)
+	if !snapshot_fits(sizer.pos) {
+		fmt.printf("Not enough memory left to snapshot this trace (%.1f MB)\n", f64(sizer.pos) / 1024 / 1024)
+		return
+	}
+
+	start_bench("write snapshot")
+	prev_offset := big_global_arena.offset
+	w := SnapWriter{buf = make([]u8, int(sizer.pos), big_global_allocator)}
+	snapshot_write(&w)
+	_store_snapshot(raw_data(w.buf), len(w.buf), download, file_name)
+	big_global_arena.offset = prev_offset
+	stop_bench("write snapshot")
+}
+
+snapshot_image: []u8
+
+// spall.js copies the snapshot straight into the pointer this hands back, then calls finish_loading_snapshot
+@export
+start_loading_snapshot :: proc "contextless" (size: u32, name: string) -> rawptr {
+	context = wasmContext
+	if u64(size) > SNAPSHOT_MAX_SIZE || int(size) < size_of(SnapHeader) {
+		return nil
+	}
+
+	init_loading_state(size, name)
+	snapshot_image = make([]u8, int(size), big_global_allocator)
+	return raw_data(snapshot_image)
+}
+
+@export
+finish_loading_snapshot :: proc "contextless" () -> bool {
+	context = wasmContext
+	defer free_all(context.temp_allocator)
+
+	start_bench("restore snapshot")
+	ok := snapshot_restore(snapshot_image)
+	snapshot_image = nil
+	if !ok {
+		return false
+	}
+	stop_bench("restore snapshot")
+	current_alloc_offset = big_global_arena.offset
+
+	t = 0
+	frame_count = 0
+	loading_config = false
+	post_loading = true
+
+	ingest_end_time := u64(get_time())
+	time_range := ingest_end_time - ingest_start_time
+	fmt.printf("runtime: %fs (%dms)\n", f32(time_range) / 1000, time_range)
+	return true
+}
+
+snap_slice :: proc(image: []u8, s: SnapSlice, $T: typeid, ok: ^bool) -> []T {
+	if s.offset > u64(len(image)) || s.len > u64(len(image)) || s.offset + (s.len * size_of(T)) > u64(len(image)) {
+		ok^ = false
+		return nil
+	}
+	return ([^]T)(raw_data(image[int(s.offset):]))[:int(s.len)]
+}
+
+// Arrays point right into the image, anything that grows one later gets a copy from the big arena
+snap_array :: proc(image: []u8, s: SnapSlice, $T: typeid, ok: ^bool) -> [dynamic]T {
+	arr := make([dynamic]T, big_global_allocator)
+	data := snap_slice(image, s, T, ok)
+	if len(data) > 0 {
+		raw := (^runtime.Raw_Dynamic_Array)(&arr)
+		raw.data = raw_data(data)
+		raw.len = len(data)
+		raw.cap = len(data)
+	}
+	return arr
+}
+
+// Everything the renderer walks without a bounds check has to land inside the arrays it indexes
+snap_depth_ok :: proc(depth: ^Depth) -> bool {
+	tree_len := uint(len(depth.tree))
+	ev_count := uint(len(depth.bs_events))
+	if ev_count == 0 {
+		return tree_len == 0
+	}
+	if depth.levels <= 0 || depth.levels > TREE_MAX_LEVELS || depth.head >= tree_len {
+		return false
+	}
+	for i := 0; i < depth.levels; i += 1 {
+		if depth.spine[i] >= tree_len {
+			return false
+		}
+	}
+
+	for node in depth.tree {
+		if node.child_count < 0 || node.child_count > CHUNK_NARY_WIDTH || node.arr_len < 0 || node.arr_len > BUCKET_SIZE {
+			return false
+		}
+		if node.start_idx > node.end_idx || node.end_idx > ev_count {
+			return false
+		}
+		if node.child_count == 0 && node.start_idx + uint(node.arr_len) > ev_count {
+			return false
+		}
+		for i := 0; i < int(node.child_count); i += 1 {
+			if node.children[i] >= tree_len {
+				return false
+			}
+		}
+	}
+	return true
+}
+
+snapshot_restore :: proc(image: []u8) -> bool {
+	hdr := (^SnapHeader)(raw_data(image))^
+	if hdr.magic != SNAPSHOT_MAGIC || hdr.version != SNAPSHOT_VERSION || hdr.size != u64(len(image)) {
+		fmt.printf("That's not a spall snapshot, or it got cut off\n")
+		return false
+	}
+	if hdr.build_hash != i64(build_hash) {
+		fmt.printf("That snapshot came from a different build of spall, open the original trace instead\n")
+		return false
+	}
+
+	ok := true
+	is_json = hdr.is_json
+	total_min_time = hdr.total_min_time
+	total_max_time = hdr.total_max_time
+	tree_min_time = hdr.total_min_time
+	event_count = hdr.event_count
+	instant_count = int(hdr.instant_count)
+	mem_event_count = int(hdr.mem_event_count)
+	color_choices = hdr.color_choices
+
+	string_block = snap_array(image, hdr.string_block, u8, &ok)
+	global_instants = snap_array(image, hdr.global_instants, Instant, &ok)
+	for entry in snap_slice(image, hdr.sample_rates, PTEntry, &ok) {
+		vh_insert(&sample_rates, entry.key, entry.val)
+	}
+	unaligned_pids = snap_array(image, hdr.unaligned_pids, u32, &ok)
+
+	snap_procs := snap_slice(image, hdr.processes, SnapProcess, &ok)
+	if !ok {
+		return false
+	}
+	for sp in snap_procs {
+		p := init_process(sp.process_id)
+		p.min_time = sp.min_time
+		p.name = sp.name
+		p.sort_index = sp.sort_index
+		p.max_live_bytes = sp.max_live_bytes
+		p.instants = snap_array(image, sp.instants, Instant, &ok)
+		p.live_bytes = snap_array(image, sp.live_bytes, MemSample, &ok)
+
+		snap_threads := snap_slice(image, sp.threads, SnapThread, &ok)
+		if !ok {
+			return false
+		}
+		for st in snap_threads {
+			tm := init_thread(st.thread_id)
+			tm.min_time = st.min_time
+			tm.max_time = st.max_time
+			tm.name = st.name
+			tm.sort_index = st.sort_index
+			tm.is_fiber = st.is_fiber
+			tm.processed = true
+			tm.instants = snap_array(image, st.instants, Instant, &ok)
+			tm.mem_events = snap_array(image, st.mem_events, MemEvent, &ok)
+			tm.suspends = snap_array(image, st.suspends, Suspend, &ok)
+
+			snap_depths := snap_slice(image, st.depths, SnapDepth, &ok)
+			if !ok {
+				return false
+			}
+			for sd in snap_depths {
+				depth := Depth{
+					head = sd.head,
+					spine = sd.spine,
+					levels = sd.levels,
+					tree = snap_array(image, sd.tree, ChunkNode, &ok),
+					bs_events = snap_array(image, sd.events, Event, &ok),
+				}
+				depth.events = depth.bs_events[:]
+				if !ok || !snap_depth_ok(&depth) {
+					fmt.printf("That snapshot's trees point outside of its events, open the original trace instead\n")
+					return false
+				}
+				append(&tm.depths, depth)
+			}
+			append(&p.threads, tm)
+		}
+		append(&processes, p)
+	}
+
+	return ok
+}
@@ -163,6 +163,25 @@ let loading_file = null;
 let loading_reader = null;
 let everythings_dead = false;
 
+// live mode, ie: spall.html?live=http://localhost:9000/<token>, pointed at tools/relay
+const LIVE_POLL_MS = 250;
+let live_url = null;
+let live_session = 0;
+let live_over = false;
+let live_last_offset = -1;
+let live_last_len = 0;
+
+// snapshots of processed traces, kept in the origin-private file system and keyed by the trace's name, size, mtime, and a sampled hash,
+// so reopening a big trace is a copy instead of a reparse
+const SNAPSHOT_MAGIC = "SPALLSNP";
+const SNAPSHOT_DIR = "spall-snapshots";
+const SNAPSHOT_KEEP = 4;
+const SNAPSHOT_SAMPLE_SIZE = 1024 * 1024;
+const SNAPSHOT_SAMPLE_COUNT = 16;
+const SNAPSHOT_CHUNK_SIZE = 64 * 1024 * 1024;
+let snapshot_key = null;
+let snapshot_save_ready = false;
+
 function implode() {
 	document.getElementById("error").classList.remove("hide");
 	document.getElementById("rect-display").classList.add("hide");
@@ -203,6 +222,88 @@ function set_error(code) {
 	}
 }
 
+// Not a content hash, see "Reopening Big Traces" in the README for what it misses
+async function snapshot_key_for(file) {
+	try {
+		let parts = [`${file.name}:${file.size}:${file.lastModified ?? 0}:`];
+		if (file.size <= SNAPSHOT_SAMPLE_SIZE * (SNAPSHOT_SAMPLE_COUNT + 2)) {
+			parts.push(file);
+		} else {
+			let step = Math.floor((file.size - SNAPSHOT_SAMPLE_SIZE) / (SNAPSHOT_SAMPLE_COUNT + 1));
+			for (let i = 0; i <= SNAPSHOT_SAMPLE_COUNT + 1; i++) {
+				let offset = Math.min(i * step, file.size - SNAPSHOT_SAMPLE_SIZE);
+				parts.push(file.slice(offset, offset + SNAPSHOT_SAMPLE_SIZE));
+			}
+		}
+
+		let digest = await crypto.subtle.digest("SHA-256", await new Blob(parts).arrayBuffer());
+		return [...new Uint8Array(digest)].map(b => b.toString(16).padStart(2, "0")).join("");
+	} catch (e) {
+		// no crypto.subtle outside of https/localhost, so no snapshots either
+		return null;
+	}
+}
+
+async function snapshot_dir() {
+	let root = await navigator.storage.getDirectory();
+	return await root.getDirectoryHandle(SNAPSHOT_DIR, { create: true });
+}
+
+async function snapshot_find(key) {
+	try {
+		let dir = await snapshot_dir();
+		let handle = await dir.getFileHandle(key);
+		return await handle.getFile();
+	} catch (e) {
+		return null;
+	}
+}
+
+async function snapshot_remove(key) {
+	try {
+		let dir = await snapshot_dir();
+		await dir.removeEntry(key);
+	} catch (e) { }
+}
+
+async function snapshot_store(key, blob) {
+	try {
+		let dir = await snapshot_dir();
+		let handle = await dir.getFileHandle(key, { create: true });
+		let writable = await handle.createWritable();
+		await writable.write(blob);
+		await writable.close();
+
+		// snapshots are about as big as the traces they came from, so only hang on to the newest few
+		let files = [];
+		for await (let entry of dir.values()) {
+			if (entry.kind === "file") {
+				files.push(await entry.getFile());
+			}
+		}
+		files.sort((a, b) => b.lastModified - a.lastModified);
+		for (let old of files.slice(SNAPSHOT_KEEP)) {
+			await dir.removeEntry(old.name);
+		}
+	} catch (e) {
+		console.log("Couldn't cache a snapshot of the trace: " + e);
+	}
+}
+
+async function is_snapshot(file) {
+	let magic = await file.slice(0, SNAPSHOT_MAGIC.length).arrayBuffer();
+	return new TextDecoder().decode(magic) === SNAPSHOT_MAGIC;
+}
+
+function download_blob(blob, name) {
+	let url = URL.createObjectURL(blob);
+	let a = document.createElement("a");
+	a.href = url;
+	a.download = name;
+	a.click();
+	setTimeout(() => URL.revokeObjectURL(url), 1000);
+}
+
 async function init() {
 	// set default error message to bug in case we get a module-level error
 	set_error(2);
@@ -362,6 +463,11 @@ async function init() {
 
 				// Config Loading
 				get_chunk(offset, size) {
+					if (live_url !== null) {
+						get_live_chunk(live_session, offset, size);
+						return;
+					}
+
 					let blob = loading_file.slice(offset, offset + size);
 					loading_reader.onload = (e) => {
 						if (e.target.error != null) {
@@ -383,6 +489,21 @@ async function init() {
 
 				open_file_dialog() {
 					document.getElementById('file-dialog').click();
+				},
+
+				// Snapshots
+				trace_loaded() {
+					snapshot_save_ready = true;
+				},
+				_store_snapshot(ptr, len, download, n, nlen) {
+					// Blob copies the bytes, so wasm can have its memory back as soon as we return
+					let blob = new Blob([window.wasm.odinMem.loadBytes(ptr >>> 0, len >>> 0)]);
+					if (download) {
+						let name = window.wasm.odinMem.loadString(n, nlen).replace(/\.(json|spall)$/, "");
+						download_blob(blob, name + ".spallsnap");
+					} else if (snapshot_key !== null) {
+						snapshot_store(snapshot_key, blob);
+					}
 				}
 			},
 		});
@@ -392,7 +513,122 @@ async function init() {
 		return;
 	}
 
-	function load_file(file) {
+	// The relay hands out whatever it has past offset. If that's nothing new, the writer
+	// hasn't caught up yet, so wait and ask again, until the relay says the writer is done.
+	function get_live_chunk(session, offset, size) {
+		fetch(`${live_url}/trace?offset=${offset}&size=${size}`).then(async (res) => {
+			let buf = await res.arrayBuffer();
+			if (session !== live_session) {
+				return;
+			}
+
+			let done = res.headers.get("X-Spall-Done") === "1";
+			let is_new = buf.byteLength > 0 && !(offset === live_last_offset && buf.byteLength <= live_last_len);
+			if (!is_new && !live_over) {
+				if (done) {
+					live_over = true;
+					window.wasm.live_stream_over(Number(res.headers.get("X-Spall-Size")));
+				} else {
+					setTimeout(() => get_live_chunk(session, offset, size), LIVE_POLL_MS);
+				}
+				return;
+			}
+
+			live_last_offset = offset;
+			live_last_len = buf.byteLength;
+			try {
+				window.wasm.load_config_chunk(...bytes(buf));
+				wakeUp();
+			} catch (e) {
+				live_url = null;
+				console.error(e);
+				implode();
+			}
+		}).catch((e) => {
+			if (session !== live_session) {
+				return;
+			}
+			console.log("Lost the relay, retrying: " + e);
+			setTimeout(() => get_live_chunk(session, offset, size), LIVE_POLL_MS * 4);
+		});
+	}
+
+	function start_live(url) {
+		live_url = url.replace(/\/+$/, "");
+		live_session += 1;
+		snapshot_key = null;
+		live_over = false;
+		live_last_offset = -1;
+		live_last_len = 0;
+
+		try {
+			window.wasm.start_live_stream(...str("live: " + live_url));
+			wakeUp();
+		} catch (e) {
+			console.error(e);
+			implode();
+			return;
+		}
+	}
+
+	// Copies the snapshot straight into wasm memory, a chunk at a time, then has wasm point everything back into it
+	async function load_snapshot(file, name, session) {
+		let ptr = window.wasm.start_loading_snapshot(file.size, ...str(name)) >>> 0;
+		if (ptr === 0) {
+			return false;
+		}
+		wakeUp();
+
+		for (let offset = 0; offset < file.size; offset += SNAPSHOT_CHUNK_SIZE) {
+			let buf = await file.slice(offset, offset + SNAPSHOT_CHUNK_SIZE).arrayBuffer();
+			if (session !== live_session) {
+				return true;
+			}
+			window.wasm.odinMem.loadBytes(ptr + offset, buf.byteLength).set(new Uint8Array(buf));
+		}
+
+		return window.wasm.finish_loading_snapshot();
+	}
+
+	async function load_file(file) {
+		live_url = null;
+		live_session += 1;
+		let session = live_session;
+		snapshot_key = null;
+		snapshot_save_ready = false;
+
+		if (await is_snapshot(file)) {
+			if (session === live_session && !(await load_snapshot(file, file.name.replace(/\.spallsnap$/, ""), session))) {
+				console.error("Couldn't open that snapshot, it only works with the build of spall that saved it");
+				set_error(3);
+				implode();
+			}
+			wakeUp();
+			return;
+		}
+
+		let key = await snapshot_key_for(file);
+		if (session !== live_session) {
+			return;
+		}
+		if (key !== null) {
+			let cached = await snapshot_find(key);
+			if (session !== live_session) {
+				return;
+			}
+			if (cached !== null) {
+				if (await load_snapshot(cached, file.name, session)) {
+					wakeUp();
+					return;
+				}
+				if (session !== live_session) {
+					return;
+				}
+				snapshot_remove(key);
+			}
+		}
+		snapshot_key = key;
+
 		loading_file = file;
 		loading_reader = new FileReader();
 
@@ -686,6 +922,14 @@ async function init() {
 
 			lastTime = currentTime;
 
+			// every thread's been processed, so there's a whole trace to snapshot
+			if (snapshot_save_ready) {
+				snapshot_save_ready = false;
+				if (snapshot_key !== null) {
+					window.wasm.save_snapshot(false);
+				}
+			}
+
 			if (animating) {
 				window.requestAnimationFrame(doFrame);
 			} else {
@@ -696,6 +940,12 @@ async function init() {
 		}
 	}
 	wakeUp();
+
+	// the first frame loads the default trace, so start streaming after it
+	let live_param = new URLSearchParams(window.location.search).get("live");
+	if (live_param) {
+		window.requestAnimationFrame(() => start_live(live_param));
+	}
 }
 
 init();
@@ -59,6 +59,7 @@ Stats :: struct {
 	min_time: f64,
 	max_time: f64,
 	count: u32,
+	allocated: u64,
 }
 Range :: struct {
 	pid: int,
@@ -79,6 +80,7 @@ SortState :: enum {
 	MinTime,
 	MaxTime,
 	AvgTime,
+	Allocated,
 }
 StatOffset :: struct {
 	range_idx: int,
@@ -108,12 +110,41 @@ TempEvent :: struct {
 	timestamp: f64,
 	thread_id: u32,
 	process_id: u32,
+	depth: u16,
 }
 Instant :: struct #packed {
 	name: INStr,
 	timestamp: f64,
 }
 
+MemEvent :: struct #packed {
+	timestamp: f64,
+	size: i64, // negative for frees
+	allocated: u64, // bytes the thread allocated up to and including this one
+}
+MemSample :: struct #packed {
+	timestamp: f64,
+	live_bytes: i64,
+}
+
+// what a fiber did, held until the end of the load, because it can be spread over any number of threads' blocks
+FiberEvent :: struct #packed {
+	name: INStr,
+	args: INStr,
+	timestamp: f64,
+	duration: f64,
+	depth: i32, // -1 unless it came in depth-tagged
+	type: EventType,
+}
+FiberSwitch :: struct #packed {
+	timestamp: f64,
+	resumed: bool,
+}
+Suspend :: struct #packed {
+	start: f64,
+	end: f64,
+}
+
 JSONEvent :: struct #packed {
 	name: INStr,
 	args: INStr,
@@ -132,6 +163,8 @@ Event :: struct #packed {
 
 BUCKET_SIZE :: 8
 CHUNK_NARY_WIDTH :: 4
+// 4^32 leaves is a lot more events than we'll ever fit in wasm memory
+TREE_MAX_LEVELS :: 32
 ChunkNode :: struct #packed {
 	start_time: f64,
 	end_time: f64,
@@ -152,6 +185,24 @@ Depth :: struct {
 	tree: [dynamic]ChunkNode,
 	bs_events: [dynamic]Event,
 	events: []Event,
+
+	// rightmost node on each level of the tree, leaves first.
+	// New buckets get hung off of this, so the tree can grow without a rebuild.
+	spine: [TREE_MAX_LEVELS]uint,
+	levels: int,
+
+	// whether the last event was still open when the tree was last built,
+	// so progressive_refresh knows to redo its leaf once it closes
+	tail_open: bool,
+
+	// time from depth-tagged completes that showed up before their parent did
+	pending_child_time: f64,
+}
+
+ClockSync :: struct {
+	pid: u32,
+	timestamp: f64, // already scaled to microseconds, like events
+	monotonic_ns: u64,
 }
 
 EVData :: struct {
@@ -167,12 +218,23 @@ Thread :: struct {
 
 	thread_id: u32,
 	name: INStr,
+	sort_index: i32,
 
 	events: [dynamic]Event,
 	json_events: [dynamic]JSONEvent,
 
 	depths: [dynamic]Depth,
 	instants: [dynamic]Instant,
+	mem_events: [dynamic]MemEvent,
+
+	// fibers get tracks of their own, stitched together from every thread that ran them
+	is_fiber: bool,
+	running_fiber: int, // the fiber track this thread's on while loading, -1 for its own stack
+	fiber_events: [dynamic]FiberEvent,
+	fiber_switches: [dynamic]FiberSwitch,
+	suspends: [dynamic]Suspend,
+
+	processed: bool, // trees (and JSON self-times) are built, see process_thread
 
 	bande_q: Stack(EVData),
 }
@@ -180,11 +242,16 @@ Thread :: struct {
 Process :: struct {
 	min_time: f64,
 	name: INStr,
+	sort_index: i32,
 
 	process_id: u32,
 	threads: [dynamic]Thread,
 	instants: [dynamic]Instant,
 	thread_map: ValHash,
+	fiber_map: ValHash,
+
+	live_bytes: [dynamic]MemSample,
+	max_live_bytes: i64,
 }
 
 init_process :: proc(process_id: u32) -> Process {
@@ -193,7 +260,9 @@ init_process :: proc(process_id: u32) -> Process {
 		process_id = process_id,
 		threads = make([dynamic]Thread, small_global_allocator),
 		thread_map = vh_init(scratch_allocator),
+		fiber_map = vh_init(scratch_allocator),
 		instants = make([dynamic]Instant, big_global_allocator),
+		live_bytes = make([dynamic]MemSample, big_global_allocator),
 	}
 }
 
@@ -205,6 +274,8 @@ init_thread :: proc(thread_id: u32) -> Thread {
 		json_events = make([dynamic]JSONEvent, big_global_allocator),
 		depths = make([dynamic]Depth, small_global_allocator),
 		instants = make([dynamic]Instant, big_global_allocator),
+		mem_events = make([dynamic]MemEvent, big_global_allocator),
+		running_fiber = -1,
 	}
 	stack_init(&t.bande_q, scratch_allocator)
 	return t
@@ -119,6 +119,18 @@ stat_fmt :: proc(time: f64) -> string {
 	}
 }
 
+bytes_fmt :: proc(bytes: f64) -> string {
+	if bytes >= 1024 * 1024 * 1024 {
+		return fmt.tprintf("%.1f GB", bytes / (1024 * 1024 * 1024))
+	} else if bytes >= 1024 * 1024 {
+		return fmt.tprintf("%.1f MB", bytes / (1024 * 1024))
+	} else if bytes >= 1024 {
+		return fmt.tprintf("%.1f KB", bytes / 1024)
+	} else {
+		return fmt.tprintf("%.0f B ", bytes)
+	}
+}
+
 time_fmt :: proc(time: f64) -> string {
 	minutes_str: string
 	seconds_str: string
@@ -0,0 +1 @@
+cc -O2 -Wall collector.c -o collector
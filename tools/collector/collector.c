@@ -0,0 +1,374 @@
+/*
+	collector: merges the traces of every process in a session into one file.
+
+	Processes trace into shared memory with spall_init_shm, instead of each writing their own file:
+		SpallProfile ctx = spall_init_shm("my_session", 1);
+	and we drain all of their rings into one trace:
+		./collector --session my_session --out merged.spall
+
+	We pick up new processes as they start (and anything left over from ones that finished
+	before we did), tag their events with their real pid, and rescale their timestamps onto
+	the first process's timestamp_unit. Timestamps only line up across processes if they all
+	read the same clock (ie: CLOCK_MONOTONIC, or an invariant TSC), or if they write clock sync
+	records (spall_buffer_clock_sync), which the viewer uses to put each pid on CLOCK_MONOTONIC.
+	Each pid also gets named after its process, unless --keep-pids is set.
+
+	Ctrl-C drains whatever's left and finishes the file.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "../../spall.h"
+
+#define MAX_RINGS 256
+#define SCAN_INTERVAL_MS 100
+#define OUT_BUFFER_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+	SpallShmRing *ring;
+	size_t map_size;
+	uint8_t *record; // scratch for one record, unwrapped
+	bool got_header;
+	double scale; // this process's timestamp_unit / ours
+	uint64_t bytes;
+} Ring;
+
+// where the pid, timestamps, and string lengths live in each event type we know how to walk
+typedef struct {
+	size_t size;
+	size_t pid;
+	size_t when; // 0 if there isn't one
+	size_t duration; // 0 if there isn't one
+	size_t name_length; // 0 if there aren't strings
+	size_t args_length; // 0 if there's only a name
+} EventLayout;
+
+#define LAYOUT(T, dur) { sizeof(T), offsetof(T, pid), offsetof(T, when), dur, offsetof(T, name_length), offsetof(T, args_length) }
+static const EventLayout layouts[] = {
+	[SpallEventType_Begin]          = LAYOUT(SpallBeginEvent, 0),
+	[SpallEventType_Complete]       = LAYOUT(SpallCompleteEvent, offsetof(SpallCompleteEvent, duration)),
+	[SpallEventType_Depth_Begin]    = LAYOUT(SpallDepthBeginEvent, 0),
+	[SpallEventType_Depth_Complete] = LAYOUT(SpallDepthCompleteEvent, offsetof(SpallDepthCompleteEvent, duration)),
+	[SpallEventType_Sampled_Begin]  = LAYOUT(SpallSampledBeginEvent, 0),
+	[SpallEventType_Instant]        = LAYOUT(SpallInstantEvent, 0),
+	[SpallEventType_End]            = { sizeof(SpallEndEvent), offsetof(SpallEndEvent, pid), offsetof(SpallEndEvent, when), 0, 0, 0 },
+	[SpallEventType_Clock_Sync]     = { sizeof(SpallClockSyncEvent), offsetof(SpallClockSyncEvent, pid), offsetof(SpallClockSyncEvent, when), 0, 0, 0 },
+	[SpallEventType_Name_Process]   = { sizeof(SpallNameProcessEvent), offsetof(SpallNameProcessEvent, pid), 0, 0, offsetof(SpallNameProcessEvent, name_length), 0 },
+	[SpallEventType_Name_Thread]    = { sizeof(SpallNameThreadEvent), offsetof(SpallNameThreadEvent, pid), 0, 0, offsetof(SpallNameThreadEvent, name_length), 0 },
+	[SpallEventType_Alloc]          = { sizeof(SpallAllocEvent), offsetof(SpallAllocEvent, pid), offsetof(SpallAllocEvent, when), 0, 0, 0 },
+	[SpallEventType_Free]           = { sizeof(SpallAllocEvent), offsetof(SpallAllocEvent, pid), offsetof(SpallAllocEvent, when), 0, 0, 0 },
+	[SpallEventType_Fiber_Switch]   = { sizeof(SpallFiberSwitchEvent), offsetof(SpallFiberSwitchEvent, pid), offsetof(SpallFiberSwitchEvent, when), 0, 0, 0 },
+};
+
+static Ring rings[MAX_RINGS];
+static int ring_count;
+
+static FILE *out_file;
+static bool wrote_header;
+static double out_timestamp_unit;
+static bool keep_pids;
+
+static volatile sig_atomic_t should_stop;
+
+static void on_stop(int signum) {
+	(void)signum;
+	should_stop = 1;
+}
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+static void scale_f64(uint8_t *p, double scale) {
+	double v;
+	memcpy(&v, p, sizeof(v));
+	v *= scale;
+	memcpy(p, &v, sizeof(v));
+}
+
+static void retag_events(Ring *r, uint8_t *p, size_t len);
+
+// Returns the block's full size, or 0 if we couldn't make sense of it
+static size_t retag_block(Ring *r, uint8_t *p, size_t len) {
+	if (len < sizeof(SpallBlockHeader)) return 0;
+
+	SpallBlockHeader block;
+	memcpy(&block, p, sizeof(block));
+	size_t block_size = sizeof(block) + block.length;
+	if (block.magic != SPALL_BLOCK_MAGIC || block_size > len) return 0;
+
+	// a block that's already bad should stay bad, don't paper over it with a fresh CRC
+	uint32_t crc = block.crc;
+	((SpallBlockHeader *)p)->crc = 0;
+	bool intact = spall_crc32c(0, p, block_size) == crc;
+	((SpallBlockHeader *)p)->crc = crc;
+	if (!intact) return block_size;
+
+	if (!keep_pids) block.pid = r->ring->pid;
+	block.min_when *= r->scale;
+	block.max_when *= r->scale;
+	block.crc = 0;
+	memcpy(p, &block, sizeof(block));
+
+	retag_events(r, p + sizeof(block), block.length);
+	put_u32(p + offsetof(SpallBlockHeader, crc), spall_crc32c(0, p, block_size));
+	return block_size;
+}
+
+static void retag_events(Ring *r, uint8_t *p, size_t len) {
+	size_t pos = 0;
+	while (pos < len) {
+		uint8_t type = p[pos];
+
+		if (type == SpallEventType_Block) {
+			size_t block_size = retag_block(r, p + pos, len - pos);
+			if (!block_size) return;
+			pos += block_size;
+			continue;
+		}
+
+		// anything we can't size, we can't walk past, so the rest of the record goes out as-is
+		if (type >= sizeof(layouts) / sizeof(layouts[0]) || !layouts[type].size) return;
+		const EventLayout *l = &layouts[type];
+		if (pos + l->size > len) return;
+
+		uint8_t *ev = p + pos;
+		size_t ev_size = l->size;
+		if (l->name_length) ev_size += ev[l->name_length];
+		if (l->args_length) ev_size += ev[l->args_length];
+		if (pos + ev_size > len) return;
+
+		if (!keep_pids) put_u32(ev + l->pid, r->ring->pid);
+		if (l->when && r->scale != 1.0) {
+			scale_f64(ev + l->when, r->scale);
+			if (l->duration) scale_f64(ev + l->duration, r->scale);
+		}
+		pos += ev_size;
+	}
+}
+
+static bool handle_record(Ring *r, uint8_t *p, size_t len) {
+	// the first thing a profile writes is its header, which we only need the timestamp_unit from
+	if (!r->got_header) {
+		SpallHeader header;
+		if (len != sizeof(header)) return false;
+		memcpy(&header, p, sizeof(header));
+		if (header.magic_header != 0x0BADF00D || header.version != 1) return false;
+
+		if (!wrote_header) {
+			out_timestamp_unit = header.timestamp_unit;
+			if (fwrite(&header, sizeof(header), 1, out_file) != 1) return false;
+			wrote_header = true;
+		}
+		r->scale = header.timestamp_unit / out_timestamp_unit;
+		r->got_header = true;
+
+		// we know what the process is called, so the viewer might as well too.
+		// It goes before any of the process's events, so its own naming (if any) still wins
+		if (!keep_pids && r->ring->process_name[0]) {
+			char name_buf[sizeof(SpallNameProcessEventMax)];
+			const char *name = r->ring->process_name;
+			size_t name_size = spall_build_name_process(name_buf, sizeof(name_buf), name, (signed long)strnlen(name, sizeof(r->ring->process_name)), 0, r->ring->pid);
+			if (fwrite(name_buf, name_size, 1, out_file) != 1) return false;
+		}
+		return true;
+	}
+
+	retag_events(r, p, len);
+	return fwrite(p, len, 1, out_file) == 1;
+}
+
+static void copy_out(SpallShmRing *ring, uint64_t pos, void *p, size_t n) {
+	uint8_t *data = spall__shm_data(ring);
+	size_t offset = (size_t)(pos & (ring->capacity - 1));
+	size_t first = SPALL_MIN(n, (size_t)ring->capacity - offset);
+	memcpy(p, data + offset, first);
+	memcpy((uint8_t *)p + first, data, n - first);
+}
+
+// Returns how many bytes we took out of the ring
+static uint64_t drain(Ring *r) {
+	SpallShmRing *ring = r->ring;
+	uint64_t start = ring->reader.pos;
+	uint64_t pos = start;
+	uint64_t end = __atomic_load_n(&ring->writer.pos, __ATOMIC_ACQUIRE);
+
+	while (pos < end) {
+		uint32_t length;
+		copy_out(ring, pos, &length, sizeof(length));
+		if (length > ring->capacity - sizeof(length) || end - pos < sizeof(length) + length) {
+			fprintf(stderr, "[%d %s] bad record at %llu, dropping the rest of this ring\n",
+				ring->pid, ring->process_name, (unsigned long long)pos);
+			pos = end;
+			break;
+		}
+
+		copy_out(ring, pos + sizeof(length), r->record, length);
+		pos += sizeof(length) + length;
+
+		// free the space up before the (slower) file write, so the writer can get going again
+		__atomic_store_n(&ring->reader.pos, pos, __ATOMIC_RELEASE);
+
+		if (!handle_record(r, r->record, length)) {
+			fprintf(stderr, "[%d %s] couldn't use a %u byte record\n", ring->pid, ring->process_name, length);
+		}
+	}
+
+	__atomic_store_n(&ring->reader.pos, pos, __ATOMIC_RELEASE);
+	r->bytes += pos - start;
+	return pos - start;
+}
+
+static void attach(const char *name) {
+	if (ring_count == MAX_RINGS) return;
+
+	char path[300];
+	snprintf(path, sizeof(path), "/%s", name);
+	int fd = shm_open(path, O_RDWR, 0);
+	if (fd < 0) return;
+
+	// the writer might not have sized it yet, we'll catch it on the next scan
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SpallShmRing)) {
+		close(fd);
+		return;
+	}
+
+	size_t map_size = (size_t)st.st_size;
+	void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) return;
+
+	SpallShmRing *ring = (SpallShmRing *)mem;
+	if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SPALL_SHM_MAGIC) {
+		munmap(mem, map_size);
+		return;
+	}
+	if (ring->version != SPALL_SHM_VERSION || sizeof(SpallShmRing) + ring->capacity != map_size) {
+		fprintf(stderr, "Skipping %s, it's not a ring we understand\n", name);
+		munmap(mem, map_size);
+		shm_unlink(path);
+		return;
+	}
+
+	uint8_t *record = malloc(ring->capacity);
+	if (!record) {
+		munmap(mem, map_size);
+		return;
+	}
+
+	// it's ours now, so nobody else should find it
+	shm_unlink(path);
+	__atomic_store_n(&ring->reader.pid, (int32_t)getpid(), __ATOMIC_RELEASE);
+
+	rings[ring_count] = (Ring){ .ring = ring, .map_size = map_size, .record = record };
+	ring_count += 1;
+	fprintf(stderr, "[%d %s] attached\n", ring->pid, ring->process_name);
+}
+
+static void scan(const char *prefix) {
+	DIR *dir = opendir("/dev/shm");
+	if (!dir) return;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+			attach(entry->d_name);
+		}
+	}
+	closedir(dir);
+}
+
+static void detach(int idx) {
+	Ring *r = &rings[idx];
+	fprintf(stderr, "[%d %s] done, %llu bytes\n", r->ring->pid, r->ring->process_name, (unsigned long long)r->bytes);
+
+	// let a writer that's still waiting on us know nobody's coming
+	__atomic_store_n(&r->ring->reader.pid, 0, __ATOMIC_RELEASE);
+	munmap(r->ring, r->map_size);
+	free(r->record);
+
+	rings[idx] = rings[ring_count - 1];
+	ring_count -= 1;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: collector --out trace.spall [--session default] [--keep-pids]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *session = "default";
+	const char *out_path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "--session") == 0) {
+			session = argv[++i];
+		} else if (i + 1 < argc && strcmp(argv[i], "--out") == 0) {
+			out_path = argv[++i];
+		} else if (strcmp(argv[i], "--keep-pids") == 0) {
+			keep_pids = true;
+		} else {
+			usage();
+		}
+	}
+	if (!out_path) usage();
+
+	out_file = fopen(out_path, "wb");
+	if (!out_file) {
+		fprintf(stderr, "Failed to open %s: %s\n", out_path, strerror(errno));
+		return 1;
+	}
+	// lots of little records from lots of processes, so batch them up into big writes
+	setvbuf(out_file, NULL, _IOFBF, OUT_BUFFER_SIZE);
+
+	signal(SIGINT, on_stop);
+	signal(SIGTERM, on_stop);
+
+	char prefix[128];
+	snprintf(prefix, sizeof(prefix), "spall-%s-", session);
+	fprintf(stderr, "Collecting session \"%s\" into %s, Ctrl-C to finish\n", session, out_path);
+
+	uint64_t last_scan = 0;
+	for (;;) {
+		bool stopping = should_stop;
+
+		if (stopping || now_ms() - last_scan >= SCAN_INTERVAL_MS) {
+			scan(prefix);
+			last_scan = now_ms();
+		}
+
+		uint64_t moved = 0;
+		for (int i = ring_count - 1; i >= 0; i--) {
+			// check closed before draining, so we can't miss anything written just before it got set
+			bool closed = __atomic_load_n(&rings[i].ring->closed, __ATOMIC_ACQUIRE);
+			moved += drain(&rings[i]);
+			if (closed) {
+				detach(i);
+			}
+		}
+
+		if (stopping) break;
+		if (!moved) usleep(1000);
+	}
+
+	for (int i = ring_count - 1; i >= 0; i--) {
+		detach(i);
+	}
+	fclose(out_file);
+	return 0;
+}
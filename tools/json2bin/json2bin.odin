@@ -45,7 +45,7 @@ main :: proc() {
 	timestamp_unit := 1.0
 	if trace.displayTimeUnit == "ns" { timestamp_unit = 1000 }
 
-	header := spall.Header{magic = spall.MAGIC, version = 0, timestamp_unit = timestamp_unit, must_be_0 = 0}
+	header := spall.Header{magic = spall.MAGIC, version = 1, timestamp_unit = timestamp_unit, must_be_0 = 0}
 	header_bytes := transmute([size_of(spall.Header)]u8)header
 	append(&buf, ..header_bytes[:])
 
@@ -56,11 +56,24 @@ main :: proc() {
 	*/
 
 	for event in trace.traceEvents {
+		name_len := min(len(event.name), 255)
+		name     := event.name[:name_len]
+
 		switch event.ph {
-		case "X", "B": // Complete or Begin Event
-			name_len := min(len(event.name), 255)
-			name     := event.name[:name_len]
+		case "X": // Complete Event
+			complete := spall.Complete_Event {
+				type = .Complete,
+				pid  = event.pid,
+				tid  = event.tid,
+				time = event.ts,
+				duration = event.dur,
+				name_len = u8(name_len),
+			}
 
+			complete_bytes := transmute([size_of(spall.Complete_Event)]u8)complete
+			append(&buf, ..complete_bytes[:])
+			append(&buf, name)
+		case "B": // Begin Event
 			begin := spall.Begin_Event {
 			 	type = .Begin,
 			 	pid  = event.pid,
@@ -72,15 +85,12 @@ main :: proc() {
 			begin_bytes := transmute([size_of(spall.Begin_Event)]u8)begin
 			append(&buf, ..begin_bytes[:])
 			append(&buf, name)
-		}
-
-		switch event.ph {
-		case "X", "E": // Complete or End Event
+		case "E": // End Event
 			end := spall.End_Event {
 			 	type = .End,
 			 	pid  = event.pid,
 			 	tid  = event.tid,
-			 	time = event.ts + event.dur,
+			 	time = event.ts,
 		 	}
 			end_bytes := transmute([size_of(spall.End_Event)]u8)end
 			append(&buf, ..end_bytes[:])
@@ -0,0 +1 @@
+cc -O2 -Wall relay.c -o relay
@@ -0,0 +1,393 @@
+/*
+	relay: hands a trace that's still being written to the viewer, a chunk at a time.
+
+	The traced program writes into us with spall_init_fd, either through a pipe:
+		./my_server | ./relay
+	or through a unix socket, if stdout is already taken:
+		./relay --socket /tmp/spall.sock
+	and then the viewer pulls from us with the URL we print at startup,
+	spall.html?live=http://localhost:9000/<token>
+
+	Everything we get is kept in memory (and in --out, if you want to keep it),
+	and served over HTTP as GET /<token>/trace?offset=N&size=M, with X-Spall-Size (bytes so far)
+	and X-Spall-Done (1 once the writer hung up) headers.
+	Any page open in your browser can reach localhost, so the random token is what keeps
+	them from reading the trace, only the URL we print has it.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_CLIENTS 32
+#define MAX_REQUEST 4096
+#define TOKEN_BYTES 16
+
+// Responses go out as the socket takes them, so one slow download doesn't stop us from draining the writer.
+// The body is an offset into trace, which can move when it grows.
+typedef struct {
+	int fd;
+	size_t req_len;
+	char req[MAX_REQUEST];
+
+	bool responding;
+	char head[512];
+	size_t head_len;
+	size_t head_sent;
+	size_t body_offset;
+	size_t body_len;
+	size_t body_sent;
+} Client;
+
+static char token[TOKEN_BYTES * 2 + 1];
+
+static uint8_t *trace;
+static size_t trace_len;
+static size_t trace_cap;
+static bool writer_done;
+static FILE *out_file;
+
+static Client clients[MAX_CLIENTS];
+static int client_count;
+
+static bool append_trace(const uint8_t *data, size_t len) {
+	if (trace_len + len > trace_cap) {
+		size_t new_cap = trace_cap ? trace_cap : (1 << 20);
+		while (new_cap < trace_len + len) new_cap *= 2;
+
+		uint8_t *new_trace = realloc(trace, new_cap);
+		if (!new_trace) return false;
+		trace = new_trace;
+		trace_cap = new_cap;
+	}
+
+	memcpy(trace + trace_len, data, len);
+	trace_len += len;
+
+	if (out_file) {
+		fwrite(data, len, 1, out_file);
+		fflush(out_file);
+	}
+	return true;
+}
+
+static uint64_t query_u64(const char *query, const char *key, uint64_t fallback) {
+	size_t key_len = strlen(key);
+	for (const char *p = query; p && *p; ) {
+		if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+			return strtoull(p + key_len + 1, NULL, 10);
+		}
+		p = strchr(p, '&');
+		if (p) p++;
+	}
+	return fallback;
+}
+
+static void respond(Client *c, int status, const char *status_str, size_t body_offset, size_t body_len) {
+	int head_len = snprintf(c->head, sizeof(c->head),
+		"HTTP/1.1 %d %s\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"Content-Length: %zu\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Access-Control-Expose-Headers: X-Spall-Size, X-Spall-Done\r\n"
+		"Cache-Control: no-store\r\n"
+		"X-Spall-Size: %zu\r\n"
+		"X-Spall-Done: %d\r\n"
+		"Connection: close\r\n"
+		"\r\n",
+		status, status_str, body_len, trace_len, writer_done ? 1 : 0);
+
+	c->responding = true;
+	c->head_len = (size_t)head_len;
+	c->head_sent = 0;
+	c->body_offset = body_offset;
+	c->body_len = body_len;
+	c->body_sent = 0;
+}
+
+// Writes whatever the socket will take right now, returns true once the client's done (or gone)
+static bool send_some(Client *c) {
+	while (c->head_sent < c->head_len || c->body_sent < c->body_len) {
+		ssize_t written;
+		if (c->head_sent < c->head_len) {
+			written = write(c->fd, c->head + c->head_sent, c->head_len - c->head_sent);
+		} else {
+			written = write(c->fd, trace + c->body_offset + c->body_sent, c->body_len - c->body_sent);
+		}
+
+		if (written < 0 && errno == EINTR) continue;
+		if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+		if (written <= 0) return true;
+
+		if (c->head_sent < c->head_len) {
+			c->head_sent += (size_t)written;
+		} else {
+			c->body_sent += (size_t)written;
+		}
+	}
+	return true;
+}
+
+static bool token_ok(const char *t, size_t len) {
+	if (len != sizeof(token) - 1) return false;
+
+	unsigned char diff = 0;
+	for (size_t i = 0; i < len; i++) diff |= (unsigned char)(t[i] ^ token[i]);
+	return diff == 0;
+}
+
+// Queues up an answer once the whole request is in
+static void serve(Client *c) {
+	char *end = strstr(c->req, "\r\n\r\n");
+	if (!end) {
+		if (c->req_len == MAX_REQUEST - 1) {
+			respond(c, 431, "Request Header Fields Too Large", 0, 0);
+		}
+		return;
+	}
+
+	char method[8] = {0};
+	char path[1024] = {0};
+	if (sscanf(c->req, "%7s %1023s", method, path) != 2 || strcmp(method, "GET") != 0) {
+		respond(c, 405, "Method Not Allowed", 0, 0);
+		return;
+	}
+
+	char *query = strchr(path, '?');
+	if (query) *query++ = '\0';
+
+	// /<token>/trace, anything else gets the same 404, so there's nothing to learn from guessing
+	char *route = path[0] == '/' ? strchr(path + 1, '/') : NULL;
+	if (!route || !token_ok(path + 1, (size_t)(route - (path + 1))) || strcmp(route, "/trace") != 0) {
+		respond(c, 404, "Not Found", 0, 0);
+		return;
+	}
+
+	uint64_t offset = query_u64(query, "offset", 0);
+	uint64_t size = query_u64(query, "size", trace_len);
+	if (offset > trace_len) offset = trace_len;
+	if (size > trace_len - offset) size = trace_len - offset;
+
+	respond(c, 200, "OK", (size_t)offset, (size_t)size);
+}
+
+static void drop_client(int idx) {
+	close(clients[idx].fd);
+	clients[idx] = clients[client_count - 1];
+	client_count -= 1;
+}
+
+static int listen_http(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	int yes = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	// only ever on localhost, traces tend to have things in them you don't want to share
+	struct sockaddr_in addr = {0};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int listen_unix(const char *path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	struct sockaddr_un addr = {0};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		close(fd);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool make_token(void) {
+	uint8_t bytes[TOKEN_BYTES];
+	FILE *urandom = fopen("/dev/urandom", "rb");
+	if (!urandom) return false;
+	bool ok = fread(bytes, sizeof(bytes), 1, urandom) == 1;
+	fclose(urandom);
+
+	for (int i = 0; i < TOKEN_BYTES; i++) {
+		snprintf(token + (i * 2), 3, "%02x", bytes[i]);
+	}
+	return ok;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: relay [--port 9000] [--socket /tmp/spall.sock] [--out trace.spall]\n");
+	fprintf(stderr, "reads the trace from stdin, unless --socket is given\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int port = 9000;
+	const char *socket_path = NULL;
+	const char *out_path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "--port") == 0) {
+			port = atoi(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "--socket") == 0) {
+			socket_path = argv[++i];
+		} else if (i + 1 < argc && strcmp(argv[i], "--out") == 0) {
+			out_path = argv[++i];
+		} else {
+			usage();
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!make_token()) {
+		fprintf(stderr, "Failed to read /dev/urandom for the access token\n");
+		return 1;
+	}
+
+	if (out_path) {
+		out_file = fopen(out_path, "wb");
+		if (!out_file) {
+			fprintf(stderr, "Failed to open %s: %s\n", out_path, strerror(errno));
+			return 1;
+		}
+	}
+
+	int http_fd = listen_http(port);
+	if (http_fd < 0) {
+		fprintf(stderr, "Failed to listen on localhost:%d: %s\n", port, strerror(errno));
+		return 1;
+	}
+
+	int writer_listen_fd = -1;
+	int writer_fd = STDIN_FILENO;
+	if (socket_path) {
+		writer_listen_fd = listen_unix(socket_path);
+		if (writer_listen_fd < 0) {
+			fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, strerror(errno));
+			return 1;
+		}
+		writer_fd = -1;
+	}
+
+	fprintf(stderr, "Open spall.html?live=http://localhost:%d/%s to watch\n", port, token);
+
+	static uint8_t read_buf[1 << 16];
+	for (;;) {
+		struct pollfd fds[MAX_CLIENTS + 3];
+		int nfds = 0;
+
+		int http_slot = nfds;
+		fds[nfds++] = (struct pollfd){ .fd = http_fd, .events = POLLIN };
+
+		int writer_slot = -1;
+		if (writer_fd >= 0) {
+			writer_slot = nfds;
+			fds[nfds++] = (struct pollfd){ .fd = writer_fd, .events = POLLIN };
+		} else if (writer_listen_fd >= 0 && !writer_done) {
+			writer_slot = nfds;
+			fds[nfds++] = (struct pollfd){ .fd = writer_listen_fd, .events = POLLIN };
+		}
+
+		int client_start = nfds;
+		for (int i = 0; i < client_count; i++) {
+			fds[nfds++] = (struct pollfd){ .fd = clients[i].fd, .events = clients[i].responding ? POLLOUT : POLLIN };
+		}
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			return 1;
+		}
+
+		if (writer_slot >= 0 && fds[writer_slot].revents) {
+			if (writer_fd < 0) {
+				// one writer per trace, so stop listening once we've got it
+				writer_fd = accept(writer_listen_fd, NULL, NULL);
+				if (writer_fd >= 0) {
+					close(writer_listen_fd);
+					writer_listen_fd = -1;
+					unlink(socket_path);
+				}
+			} else {
+				ssize_t got = read(writer_fd, read_buf, sizeof(read_buf));
+				if (got > 0) {
+					if (!append_trace(read_buf, (size_t)got)) {
+						fprintf(stderr, "Out of memory at %zu bytes\n", trace_len);
+						return 1;
+					}
+				} else if (got == 0 || errno != EINTR) {
+					fprintf(stderr, "Writer's done, got %zu bytes\n", trace_len);
+					if (writer_fd != STDIN_FILENO) close(writer_fd);
+					writer_fd = -1;
+					writer_done = true;
+					if (out_file) fclose(out_file);
+					out_file = NULL;
+				}
+			}
+		}
+
+		// walk backwards, so dropping a client doesn't skip the one that gets swapped in
+		for (int i = client_count - 1; i >= 0; i--) {
+			if (!fds[client_start + i].revents) continue;
+
+			Client *c = &clients[i];
+			if (!c->responding) {
+				ssize_t got = read(c->fd, c->req + c->req_len, MAX_REQUEST - 1 - c->req_len);
+				if (got < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+				if (got <= 0) {
+					drop_client(i);
+					continue;
+				}
+				c->req_len += (size_t)got;
+				c->req[c->req_len] = '\0';
+
+				serve(c);
+				if (!c->responding) continue;
+			}
+
+			if (send_some(c)) {
+				drop_client(i);
+			}
+		}
+
+		if (fds[http_slot].revents) {
+			int fd = accept(http_fd, NULL, NULL);
+			if (fd >= 0) {
+				if (client_count == MAX_CLIENTS) {
+					close(fd);
+				} else {
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+					clients[client_count] = (Client){ .fd = fd };
+					client_count += 1;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1 @@
+odin build main.odin -file -collection:formats='../../formats' -o:speed -out:validate
@@ -0,0 +1,726 @@
+package validate
+
+import "core:fmt"
+import "core:os"
+import "core:math"
+import "formats:spall"
+
+// Streams a .spall file once, checking everything the viewer would choke on,
+// and reports *where* it happened instead of just failing to load.
+
+READ_SIZE :: 4 * 1024 * 1024
+MAX_REPORTS_PER_KIND :: 10
+
+Problem :: enum {
+	Unknown_Event,
+	Unsupported_Event,
+	Truncated_Event,
+	Unmatched_End,
+	Unmatched_Begin,
+	Time_Travel,
+	Bad_Timestamp,
+	Long_Name,
+	Empty_Name,
+	Bad_Block,
+	Corrupt_Block,
+	Bad_Sample_Rate,
+	Bad_Clock_Sync,
+}
+
+problem_names := [Problem]string{
+	.Unknown_Event     = "unknown event type",
+	.Unsupported_Event = "event type the viewer can't load",
+	.Truncated_Event   = "truncated event",
+	.Unmatched_End     = "end without a begin",
+	.Unmatched_Begin   = "begin without an end",
+	.Time_Travel       = "time travel",
+	.Bad_Timestamp     = "NaN/Inf timestamp",
+	.Long_Name         = "name/args at 255 bytes (probably truncated)",
+	.Empty_Name        = "empty name",
+	.Bad_Block         = "event that doesn't fit its block",
+	.Corrupt_Block     = "corrupt block (the viewer skips these)",
+	.Bad_Sample_Rate   = "sample rate of 0 (the viewer counts it as 1)",
+	.Bad_Clock_Sync    = "clock sync that runs backwards (the viewer's fit for that pid gets thrown off)",
+}
+
+// problems that make the viewer reject the file outright, vs. ones that just look wrong
+is_fatal := #partial [Problem]bool{
+	.Unknown_Event     = true,
+	.Unsupported_Event = true,
+	.Truncated_Event   = true,
+	.Time_Travel       = true,
+	.Bad_Timestamp     = true,
+}
+
+ThreadState :: struct {
+	pid: u32,
+	tid: u32,
+	depth: i64,
+	last_time: f64,
+	complete_end: f64,
+	depth_ends: [dynamic]f64, // end of the last depth-tagged event at each depth
+	first_open_offset: i64,
+	begins: u64,
+	ends: u64,
+	completes: u64,
+
+	fiber: u32, // what the thread's running right now, 0 for its own stack
+	is_fiber: bool,
+}
+
+Validator :: struct {
+	threads: map[u64]ThreadState,
+	fibers: map[u64]ThreadState,
+	clock_syncs: map[u32]spall.Clock_Sync_Event, // last one per pid
+	counts: [Problem]u64,
+	event_counts: [spall.Event_Type]u64,
+	event_total: u64,
+
+	in_block: bool,
+	block: spall.Block_Header,
+	block_offset: i64,
+	block_end: i64,
+	block_crc: u32, // running CRC32C of the block so far
+	seen_block: bool,
+
+	// like the viewer, skip garbage in a blocked trace by scanning ahead to the next block header
+	resync_start: i64, // -1 when we're not skipping
+	lost_bytes: i64,
+	lost_regions: u64,
+}
+
+v: Validator
+
+report :: proc(problem: Problem, offset: i64, msg: string, args: ..any) {
+	v.counts[problem] += 1
+	if v.counts[problem] > MAX_REPORTS_PER_KIND {
+		return
+	}
+
+	fmt.printf("[%s] @ byte %d: ", is_fatal[problem] ? "error" : "warning", offset)
+	fmt.printf(msg, ..args)
+	fmt.printf("\n")
+}
+
+get_os_thread :: #force_inline proc(pid, tid: u32) -> ^ThreadState {
+	key := u64(pid) << 32 | u64(tid)
+	t, ok := &v.threads[key]
+	if !ok {
+		v.threads[key] = ThreadState{pid = pid, tid = tid, last_time = math.inf_f64(-1), complete_end = math.inf_f64(-1), first_open_offset = -1}
+		t, _ = &v.threads[key]
+	}
+	return t
+}
+
+// events on a thread that's running a fiber get checked against the fiber instead
+get_thread :: #force_inline proc(pid, tid: u32) -> ^ThreadState {
+	t := get_os_thread(pid, tid)
+	if t.fiber == 0 {
+		return t
+	}
+
+	key := u64(pid) << 32 | u64(t.fiber)
+	f, ok := &v.fibers[key]
+	if !ok {
+		v.fibers[key] = ThreadState{pid = pid, tid = t.fiber, is_fiber = true, first_open_offset = -1}
+		f, _ = &v.fibers[key]
+	}
+	return f
+}
+
+check_time :: proc(t: ^ThreadState, offset: i64, time: f64) {
+	if math.is_nan(time) || math.is_inf(time) {
+		report(.Bad_Timestamp, offset, "[pid: %d, tid: %d] got %f", t.pid, t.tid, time)
+		return
+	}
+
+	// a fiber's events come out of every thread that ran it, so they're only in order once the viewer sorts them
+	if t.is_fiber {
+		return
+	}
+
+	if time < t.last_time {
+		report(.Time_Travel, offset, "[pid: %d, tid: %d] event at %f comes before the previous event at %f", t.pid, t.tid, time, t.last_time)
+	}
+	t.last_time = max(t.last_time, time)
+}
+
+// completes close themselves, so nothing can start on the thread until they're over
+check_overlap :: proc(t: ^ThreadState, offset: i64, time: f64) {
+	if t.is_fiber {
+		return
+	}
+	if time < t.complete_end {
+		report(.Time_Travel, offset, "[pid: %d, tid: %d] event at %f starts before the previous complete ends at %f", t.pid, t.tid, time, t.complete_end)
+	}
+}
+
+// depth-tagged events only need to be in order within their own depth
+check_depth_time :: proc(t: ^ThreadState, offset: i64, depth: u16, time, end: f64) {
+	if math.is_nan(time) || math.is_inf(time) || math.is_nan(end) || math.is_inf(end) {
+		report(.Bad_Timestamp, offset, "[pid: %d, tid: %d] got %f -> %f", t.pid, t.tid, time, end)
+		return
+	}
+	if t.is_fiber {
+		return
+	}
+
+	for int(depth) >= len(t.depth_ends) {
+		append(&t.depth_ends, math.inf_f64(-1))
+	}
+	if time < t.depth_ends[depth] {
+		report(.Time_Travel, offset, "[pid: %d, tid: %d] event at %f starts before the previous one at depth %d ends at %f", t.pid, t.tid, time, depth, t.depth_ends[depth])
+	}
+	t.depth_ends[depth] = max(t.depth_ends[depth], end)
+}
+
+check_name :: proc(offset: i64, pid, tid: u32, name: string, name_len, args_len: u8) {
+	if name_len == 0 {
+		report(.Empty_Name, offset, "[pid: %d, tid: %d] event has no name", pid, tid)
+	}
+	if name_len == 255 || args_len == 255 {
+		report(.Long_Name, offset, "[pid: %d, tid: %d] %.32s...", pid, tid, name)
+	}
+}
+
+check_block :: proc(offset: i64, pid, tid: u32, time_begin, time_end: f64) {
+	if !v.in_block {
+		return
+	}
+
+	if pid != v.block.pid || tid != v.block.tid {
+		report(.Bad_Block, offset, "[pid: %d, tid: %d] event in the block @ byte %d for [pid: %d, tid: %d]", pid, tid, v.block_offset, v.block.pid, v.block.tid)
+	}
+	if time_begin < v.block.min_time || time_end > v.block.max_time {
+		report(.Bad_Block, offset, "[pid: %d, tid: %d] event at %f -> %f is outside the block's %f -> %f", pid, tid, time_begin, time_end, v.block.min_time, v.block.max_time)
+	}
+}
+
+ParseState :: enum {
+	Ok,
+	Need_More,
+	Stop,
+	Resync,
+}
+
+// offset is the absolute file position of data[0]
+validate_event :: proc(data: []u8, offset: i64) -> (ParseState, i64) {
+	if len(data) < 1 {
+		return .Need_More, 0
+	}
+
+	type := (^spall.Event_Type)(raw_data(data))^
+	#partial switch type {
+	case .Begin:
+		event_sz := i64(size_of(spall.Begin_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Begin_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_time(t, offset, event.time)
+		check_overlap(t, offset, event.time)
+
+		name := string(data[event_sz:event_sz+i64(event.name_len)])
+		check_name(offset, event.pid, event.tid, name, event.name_len, event.args_len)
+
+		if t.depth == 0 {
+			t.first_open_offset = offset
+		}
+		t.depth += 1
+		t.begins += 1
+
+		return .Ok, event_sz + event_tail
+	case .Sampled_Begin:
+		event_sz := i64(size_of(spall.Sampled_Begin_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Sampled_Begin_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_time(t, offset, event.time)
+		check_overlap(t, offset, event.time)
+
+		name := string(data[event_sz:event_sz+i64(event.name_len)])
+		check_name(offset, event.pid, event.tid, name, event.name_len, event.args_len)
+
+		if event.sample_rate == 0 {
+			report(.Bad_Sample_Rate, offset, "[pid: %d, tid: %d] \"%s\" has a sample rate of 0", t.pid, t.tid, name)
+		}
+
+		if t.depth == 0 {
+			t.first_open_offset = offset
+		}
+		t.depth += 1
+		t.begins += 1
+
+		return .Ok, event_sz + event_tail
+	case .Complete:
+		event_sz := i64(size_of(spall.Complete_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Complete_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time + event.duration)
+		check_time(t, offset, event.time)
+		check_overlap(t, offset, event.time)
+
+		if math.is_nan(event.duration) || math.is_inf(event.duration) {
+			report(.Bad_Timestamp, offset, "[pid: %d, tid: %d] got duration %f", t.pid, t.tid, event.duration)
+		} else {
+			t.complete_end = max(t.complete_end, event.time + event.duration)
+		}
+
+		name := string(data[event_sz:event_sz+i64(event.name_len)])
+		check_name(offset, event.pid, event.tid, name, event.name_len, event.args_len)
+
+		t.completes += 1
+		return .Ok, event_sz + event_tail
+	case .Depth_Begin:
+		event_sz := i64(size_of(spall.Depth_Begin_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Depth_Begin_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_depth_time(t, offset, event.depth, event.time, event.time)
+
+		name := string(data[event_sz:event_sz+i64(event.name_len)])
+		check_name(offset, event.pid, event.tid, name, event.name_len, event.args_len)
+
+		if event.depth == 0 {
+			t.first_open_offset = offset
+		}
+		t.depth = i64(event.depth) + 1
+		t.begins += 1
+
+		return .Ok, event_sz + event_tail
+	case .Depth_Complete:
+		event_sz := i64(size_of(spall.Depth_Complete_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Depth_Complete_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time + event.duration)
+		check_depth_time(t, offset, event.depth, event.time, event.time + event.duration)
+
+		name := string(data[event_sz:event_sz+i64(event.name_len)])
+		check_name(offset, event.pid, event.tid, name, event.name_len, event.args_len)
+
+		t.completes += 1
+		return .Ok, event_sz + event_tail
+	case .End:
+		event_sz := i64(size_of(spall.End_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.End_Event)(raw_data(data))
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_time(t, offset, event.time)
+
+		// a fiber's end can show up before its begin, if the thread that resumed it flushed first
+		if t.depth == 0 && !t.is_fiber {
+			report(.Unmatched_End, offset, "[pid: %d, tid: %d] at %f", event.pid, event.tid, event.time)
+		} else {
+			t.depth -= 1
+			if t.depth >= 0 && t.depth < i64(len(t.depth_ends)) {
+				t.depth_ends[t.depth] = max(t.depth_ends[t.depth], event.time)
+			}
+		}
+		t.ends += 1
+
+		return .Ok, event_sz
+	case .Instant:
+		event_sz := i64(size_of(spall.Instant_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Instant_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len) + i64(event.args_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		// instants don't open anything, so they're fine inside a complete
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_time(t, offset, event.time)
+
+		name := string(data[event_sz:event_sz+i64(event.name_len)])
+		check_name(offset, event.pid, event.tid, name, event.name_len, event.args_len)
+
+		return .Ok, event_sz + event_tail
+	case .Fiber_Switch:
+		event_sz := i64(size_of(spall.Fiber_Switch_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Fiber_Switch_Event)(raw_data(data))
+
+		t := get_os_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_time(t, offset, event.time)
+
+		t.fiber = event.fiber
+		return .Ok, event_sz
+	case .Alloc, .Free:
+		event_sz := i64(size_of(spall.Alloc_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Alloc_Event)(raw_data(data))
+
+		t := get_thread(event.pid, event.tid)
+		check_block(offset, event.pid, event.tid, event.time, event.time)
+		check_time(t, offset, event.time)
+
+		return .Ok, event_sz
+	case .Clock_Sync:
+		event_sz := i64(size_of(spall.Clock_Sync_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Clock_Sync_Event)(raw_data(data))
+
+		if v.in_block && event.pid != v.block.pid {
+			report(.Bad_Block, offset, "[pid: %d] clock sync in the block @ byte %d for [pid: %d, tid: %d]", event.pid, v.block_offset, v.block.pid, v.block.tid)
+		}
+		if math.is_nan(event.time) || math.is_inf(event.time) {
+			report(.Bad_Timestamp, offset, "[pid: %d] clock sync at %f", event.pid, event.time)
+		}
+
+		if last, ok := v.clock_syncs[event.pid]; ok {
+			if event.monotonic_ns < last.monotonic_ns || event.time < last.time {
+				report(.Bad_Clock_Sync, offset, "[pid: %d] %f @ %d ns comes after %f @ %d ns", event.pid, event.time, event.monotonic_ns, last.time, last.monotonic_ns)
+			}
+		}
+		v.clock_syncs[event.pid] = event^
+
+		return .Ok, event_sz
+	case .Name_Process:
+		event_sz := i64(size_of(spall.Name_Process_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Name_Process_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		if v.in_block && event.pid != v.block.pid {
+			report(.Bad_Block, offset, "[pid: %d] process name in the block @ byte %d for [pid: %d, tid: %d]", event.pid, v.block_offset, v.block.pid, v.block.tid)
+		}
+		if event.name_len == 255 {
+			report(.Long_Name, offset, "[pid: %d] %.32s...", event.pid, string(data[event_sz:event_sz+event_tail]))
+		}
+
+		return .Ok, event_sz + event_tail
+	case .Name_Thread:
+		event_sz := i64(size_of(spall.Name_Thread_Event))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		event := (^spall.Name_Thread_Event)(raw_data(data))
+
+		event_tail := i64(event.name_len)
+		if i64(len(data)) < event_sz + event_tail {
+			return .Need_More, 0
+		}
+
+		if v.in_block && (event.pid != v.block.pid || event.tid != v.block.tid) {
+			report(.Bad_Block, offset, "[pid: %d, tid: %d] thread name in the block @ byte %d for [pid: %d, tid: %d]", event.pid, event.tid, v.block_offset, v.block.pid, v.block.tid)
+		}
+		if event.name_len == 255 {
+			report(.Long_Name, offset, "[pid: %d, tid: %d] %.32s...", event.pid, event.tid, string(data[event_sz:event_sz+event_tail]))
+		}
+
+		return .Ok, event_sz + event_tail
+	case .Block:
+		event_sz := i64(size_of(spall.Block_Header))
+		if i64(len(data)) < event_sz {
+			return .Need_More, 0
+		}
+		block := (^spall.Block_Header)(raw_data(data))
+		if block.magic != spall.BLOCK_MAGIC {
+			report(.Corrupt_Block, offset, "bad block magic 0x%X, expected 0x%X", block.magic, spall.BLOCK_MAGIC)
+			return .Resync, 0
+		}
+		if block.length > spall.MAX_BLOCK_SIZE {
+			report(.Corrupt_Block, offset, "[pid: %d, tid: %d] block length %d is over the %d byte cap", block.pid, block.tid, block.length, spall.MAX_BLOCK_SIZE)
+			return .Resync, 0
+		}
+		v.seen_block = true
+
+		if v.in_block {
+			report(.Bad_Block, offset, "block starts inside the block @ byte %d", v.block_offset)
+		}
+		if block.length == 0 {
+			report(.Bad_Block, offset, "[pid: %d, tid: %d] empty block", block.pid, block.tid)
+		} else {
+			v.in_block = true
+			v.block = block^
+			v.block_offset = offset
+			v.block_end = offset + event_sz + i64(block.length)
+			v.block_crc = spall.block_header_crc(block^)
+		}
+
+		return .Ok, event_sz
+	case .Custom_Data, .StreamOver, .Overwrite_Timestamp:
+		// None of these have a defined size yet, so we can't walk past them
+		report(.Unsupported_Event, offset, "%v", type)
+		return .Stop, 0
+	case:
+		// once there are blocks, the viewer skips past garbage instead of giving up
+		if v.seen_block {
+			report(.Corrupt_Block, offset, "unknown type byte %d", u8(type))
+			return .Resync, 0
+		}
+		report(.Unknown_Event, offset, "type byte %d", u8(type))
+		return .Stop, 0
+	}
+}
+
+// Finds the next block header in data, or false if there isn't a whole one in it yet
+find_block :: proc(data: []u8) -> (int, bool) {
+	magic_sz := size_of(spall.Event_Type) + size_of(u32)
+	for i := 0; i + magic_sz <= len(data); i += 1 {
+		if spall.Event_Type(data[i]) == .Block && (^u32)(raw_data(data[i+1:]))^ == spall.BLOCK_MAGIC {
+			return i, true
+		}
+	}
+	return 0, false
+}
+
+validate_header :: proc(data: []u8) -> bool {
+	header_sz := size_of(spall.Header)
+	if len(data) < header_sz {
+		fmt.printf("[error] @ byte 0: file is %d bytes, too small for a header (%d bytes)\n", len(data), header_sz)
+		return false
+	}
+
+	hdr := cast(^spall.Header)raw_data(data)
+	if hdr.magic != spall.MAGIC {
+		fmt.printf("[error] @ byte 0: bad magic 0x%X, expected 0x%X (JSON traces aren't checked here)\n", hdr.magic, spall.MAGIC)
+		return false
+	}
+	if hdr.version != 1 {
+		fmt.printf("[error] @ byte 8: version %d is not supported (expected 1), see tools/upconvert\n", hdr.version)
+		return false
+	}
+	if !(hdr.timestamp_unit > 0) || math.is_inf(hdr.timestamp_unit) {
+		fmt.printf("[error] @ byte 16: timestamp unit %f is not a positive number\n", hdr.timestamp_unit)
+		return false
+	}
+	if hdr.must_be_0 != 0 {
+		fmt.printf("[warning] @ byte 24: reserved header field is %d, expected 0\n", hdr.must_be_0)
+	}
+
+	fmt.printf("header: version %d, timestamp unit %f μs\n", hdr.version, hdr.timestamp_unit)
+	return true
+}
+
+main :: proc() {
+	if len(os.args) < 2 {
+		fmt.eprintf("%v <trace.spall>\n", os.args[0])
+		os.exit(1)
+	}
+
+	fd, err := os.open(os.args[1])
+	if err != 0 {
+		fmt.eprintf("%v could not be opened for reading.\n", os.args[1])
+		os.exit(1)
+	}
+	defer os.close(fd)
+
+	file_size, _ := os.file_size(fd)
+	v.threads = make(map[u64]ThreadState)
+	v.resync_start = -1
+
+	// buf holds the unparsed tail of the last read, followed by the next read
+	buf := make([]u8, READ_SIZE * 2)
+	buf_len := 0
+	file_pos: i64 = 0  // absolute offset of buf[0]
+	eof := false
+	got_header := false
+	stopped := false
+
+	read_loop: for !eof {
+		n, read_err := os.read(fd, buf[buf_len:buf_len+READ_SIZE])
+		if read_err != 0 {
+			fmt.eprintf("Failed to read %v @ byte %d\n", os.args[1], file_pos + i64(buf_len))
+			os.exit(1)
+		}
+		if n == 0 {
+			eof = true
+		}
+		buf_len += n
+
+		pos := 0
+		if !got_header {
+			if buf_len < size_of(spall.Header) && !eof {
+				continue
+			}
+			if !validate_header(buf[:buf_len]) {
+				os.exit(1)
+			}
+			got_header = true
+			pos += size_of(spall.Header)
+		}
+
+		for pos < buf_len {
+			if v.resync_start >= 0 {
+				next, found := find_block(buf[pos:buf_len])
+				if !found {
+					// a header could be straddling the end of the read, so hang onto its first few bytes
+					pos = max(pos, buf_len - (size_of(spall.Event_Type) + size_of(u32)) + 1)
+					break
+				}
+
+				pos += next
+				block_start := file_pos + i64(pos)
+				fmt.printf("[warning] @ byte %d: skipped %d bytes of corrupt data, up to the next block @ byte %d\n", v.resync_start, block_start - v.resync_start, block_start)
+				v.lost_bytes += block_start - v.resync_start
+				v.lost_regions += 1
+				v.resync_start = -1
+			}
+
+			state, size := validate_event(buf[pos:buf_len], file_pos + i64(pos))
+			if state == .Need_More {
+				break
+			}
+			if state == .Stop {
+				stopped = true
+				file_pos += i64(pos)
+				break read_loop
+			}
+			if state == .Resync {
+				v.in_block = false
+				v.resync_start = file_pos + i64(pos)
+				pos += 1
+				continue
+			}
+
+			type := (^spall.Event_Type)(&buf[pos])^
+			v.event_counts[type] += 1
+			if type != .Block {
+				v.event_total += 1
+			}
+
+			event_end := file_pos + i64(pos) + size
+			if v.in_block && type != .Block {
+				v.block_crc = spall.crc32c(v.block_crc, buf[pos:pos+int(size)])
+
+				if event_end >= v.block_end {
+					if event_end > v.block_end {
+						report(.Bad_Block, file_pos + i64(pos), "event runs %d bytes past the end of the block @ byte %d", event_end - v.block_end, v.block_offset)
+					} else if v.block_crc != v.block.crc {
+						report(.Corrupt_Block, v.block_offset, "[pid: %d, tid: %d] checksum is 0x%X, expected 0x%X", v.block.pid, v.block.tid, v.block_crc, v.block.crc)
+					}
+					v.in_block = false
+				}
+			}
+			pos += int(size)
+		}
+
+		if eof && pos < buf_len && v.resync_start < 0 {
+			report(.Truncated_Event, file_pos + i64(pos), "%d trailing bytes don't make a full event", buf_len - pos)
+		}
+
+		// slide the partial event down to the front of the buffer
+		copy(buf[:], buf[pos:buf_len])
+		file_pos += i64(pos)
+		buf_len -= pos
+	}
+
+	if v.resync_start >= 0 {
+		fmt.printf("[warning] @ byte %d: skipped the last %d bytes as corrupt data, no good blocks after it\n", v.resync_start, file_size - v.resync_start)
+		v.lost_bytes += file_size - v.resync_start
+		v.lost_regions += 1
+	}
+
+	for _, t in v.threads {
+		if t.depth > 0 {
+			report(.Unmatched_Begin, t.first_open_offset, "[pid: %d, tid: %d] %d begin(s) never ended, first still-open begin is here", t.pid, t.tid, t.depth)
+		}
+	}
+	for _, f in v.fibers {
+		if f.depth > 0 {
+			report(.Unmatched_Begin, f.first_open_offset, "[pid: %d, fiber: %d] %d begin(s) never ended", f.pid, f.tid, f.depth)
+		} else if f.depth < 0 {
+			report(.Unmatched_End, 0, "[pid: %d, fiber: %d] %d end(s) without a begin", f.pid, f.tid, -f.depth)
+		}
+	}
+
+	fmt.printf("\n")
+	if stopped {
+		fmt.printf("stopped early @ byte %d of %d, the rest of the file can't be walked\n", file_pos, file_size)
+	}
+	fmt.printf("%d bytes, %d events (%d begin, %d end, %d complete) across %d threads\n",
+		file_size, v.event_total,
+		v.event_counts[.Begin] + v.event_counts[.Depth_Begin], v.event_counts[.End],
+		v.event_counts[.Complete] + v.event_counts[.Depth_Complete], len(v.threads))
+	if v.event_counts[.Block] > 0 {
+		fmt.printf("%d blocks\n", v.event_counts[.Block])
+	}
+	if v.lost_regions > 0 {
+		fmt.printf("skipped %d bytes in %d corrupt region(s)\n", v.lost_bytes, v.lost_regions)
+	}
+
+	errors := u64(0)
+	for count, problem in v.counts {
+		if count == 0 {
+			continue
+		}
+
+		fmt.printf("  %8d x %s\n", count, problem_names[problem])
+		if is_fatal[problem] {
+			errors += count
+		}
+	}
+
+	if errors > 0 {
+		fmt.printf("FAILED\n")
+		os.exit(1)
+	}
+	fmt.printf("OK\n")
+}